@@ -0,0 +1,352 @@
+#include "blockchain.h"
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <mutex>
+#include <atomic>
+
+// Synthetic chain benchmark, prints a JSON report
+// usage: bench.elf [blocks N] [payload BYTES] [keysize BYTES] [algorithm rsa|ecdsa] [selfverify N] [branch PERCENT] [samples N] [lookups N] [rounds N] [threads N] [database PATH] [output PATH]
+
+struct Options {
+    size_t blocks = 1000; // blocks generated on top of the root
+    size_t payload = 64; // data bytes per block
+    int keySize = 256; // RSA key size in bytes
+    SignatureAlgorithm algorithm = SignatureAlgorithm::RsaPss;
+    size_t selfVerify = 1; // check every nth signature, 0 never
+    size_t branch = 10; // percent of blocks stemming off a random earlier block instead of the last one
+    size_t samples = 1000; // blocks timed for hashing, signing and verification
+    size_t lookups = 100000;
+    size_t rounds = 3; // export / import repetitions
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string database = "bench.chain";
+    std::string output; // stdout when empty
+};
+
+class Samples { // latency samples in nanoseconds
+    std::vector<double> values;
+    bool sorted = true;
+
+public:
+    inline void Add(double ns) { values.push_back(ns); sorted = false; }
+    inline size_t Count() const { return values.size(); }
+
+    double Total() const {
+        double total = 0;
+        for(double v : values) total += v;
+        return total;
+    }
+
+    double Percentile(double p) {
+        if(values.empty()) return 0;
+        if(!sorted){
+            std::sort(values.begin(), values.end());
+            sorted = true;
+        }
+        size_t rank = size_t(p / 100.0 * (values.size() - 1) + 0.5);
+        return values[std::min(rank, values.size() - 1)];
+    }
+};
+
+struct Result {
+    std::string name;
+    Samples latency {};
+    size_t items = 1; // blocks handled per operation
+    uint64_t bytes = 0; // bytes handled over all operations
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static double Elapsed(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+static void Quiet(bool on) { // the library reports through std::cout
+    if(on) std::cout.setstate(std::ios::failbit); else std::cout.clear();
+}
+
+static bool ParseArgs(int argc, const char** argv, Options& options) {
+    for(int i=1; i + 1 < argc; i += 2){
+        std::string arg = argv[i], value = argv[i + 1];
+        try {
+            if(arg == "blocks") options.blocks = std::stoull(value);
+            else if(arg == "payload") options.payload = std::stoull(value);
+            else if(arg == "keysize") options.keySize = std::stoi(value);
+            else if(arg == "algorithm"){
+                if(value != "rsa" && value != "ecdsa") throw std::invalid_argument(value);
+                options.algorithm = (value == "rsa" ? SignatureAlgorithm::RsaPss : SignatureAlgorithm::EcdsaP256);
+            }
+            else if(arg == "selfverify") options.selfVerify = std::stoull(value);
+            else if(arg == "branch") options.branch = std::stoull(value);
+            else if(arg == "samples") options.samples = std::stoull(value);
+            else if(arg == "lookups") options.lookups = std::stoull(value);
+            else if(arg == "rounds") options.rounds = std::max<size_t>(1, std::stoull(value));
+            else if(arg == "threads") options.threads = std::max(1, std::stoi(value));
+            else if(arg == "database") options.database = value;
+            else if(arg == "output") options.output = value;
+            else {
+                std::cerr << "unknown option " << arg << "\n";
+                return false;
+            }
+        } catch (std::exception&) {
+            std::cerr << "invalid value for " << arg << "\n";
+            return false;
+        }
+    }
+    return (argc % 2) == 1;
+}
+
+static std::string RandomPayload(std::mt19937_64& rng, size_t size) {
+    std::string data(size, ' ');
+    for(char& c : data) c = char('a' + rng() % 26);
+    return data;
+}
+
+static void WriteReport(std::ostream& out, const Options& options, std::vector<Result>& results) {
+    out << "{\n"
+        << "  \"config\": { \"blocks\": " << options.blocks << ", \"payload\": " << options.payload
+        << ", \"keysize\": " << options.keySize << ", \"algorithm\": \"" << SignatureScheme::Find(options.algorithm)->Name()
+        << "\", \"selfverify\": " << options.selfVerify << ", \"branch\": " << options.branch
+        << ", \"samples\": " << options.samples << ", \"lookups\": " << options.lookups
+        << ", \"rounds\": " << options.rounds << ", \"threads\": " << options.threads << " },\n"
+        << "  \"results\": [\n";
+
+    for(size_t i=0; i < results.size(); ++i){
+        Result& r = results[i];
+        double seconds = r.latency.Total() / 1e9;
+        double ops = (seconds > 0 ? r.latency.Count() / seconds : 0);
+
+        out << "    { \"name\": \"" << r.name << "\", \"ops\": " << r.latency.Count()
+            << ", \"seconds\": " << seconds << ", \"ops_per_sec\": " << ops
+            << ", \"items_per_sec\": " << ops * r.items
+            << ", \"bytes_per_sec\": " << (seconds > 0 ? r.bytes / seconds : 0)
+            << ", \"latency_ns\": { \"mean\": " << (r.latency.Count() ? r.latency.Total() / r.latency.Count() : 0)
+            << ", \"p50\": " << r.latency.Percentile(50) << ", \"p90\": " << r.latency.Percentile(90)
+            << ", \"p99\": " << r.latency.Percentile(99) << ", \"max\": " << r.latency.Percentile(100) << " } }"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+
+    out << "  ]\n}\n";
+}
+
+int main(int argc, const char** argv) {
+    Options options;
+    if(!ParseArgs(argc, argv, options)){
+        std::cerr << "usage: bench.elf [blocks N] [payload BYTES] [keysize BYTES] [algorithm rsa|ecdsa] [selfverify N] [branch PERCENT] [samples N] [lookups N] [rounds N] [threads N] [database PATH] [output PATH]\n";
+        return 1;
+    }
+
+    std::mt19937_64 rng(12345); // fixed seed, runs are comparable
+    std::vector<Result> results;
+
+    Blockchain chain;
+    chain.SetSelfVerify(options.selfVerify);
+    Quiet(true);
+    bool generated = chain.GenerateNewBlockChain("bench", options.keySize, options.algorithm);
+    Quiet(false);
+    if(!generated){
+        std::cerr << "failed to generate the chain\n";
+        return 1;
+    }
+
+    { // synthetic chain, each block signed and verified by CreateBlock
+        Result create { "CreateBlock" };
+        Quiet(true);
+        for(size_t i=1; i <= options.blocks; ++i){
+            uint32_t stem = uint32_t(i - 1);
+            if(rng() % 100 < options.branch) stem = uint32_t(rng() % i);
+            std::string data = RandomPayload(rng, options.payload);
+
+            Clock::time_point start = Clock::now();
+            bool created = chain.CreateBlock(stem, "", data);
+            create.latency.Add(Elapsed(start));
+            create.bytes += data.size();
+
+            if(!created){
+                Quiet(false);
+                std::cerr << "failed to create block " << i << "\n";
+                return 1;
+            }
+        }
+        Quiet(false);
+        results.push_back(std::move(create));
+    }
+
+    const size_t total = chain.GetBlockChainSize();
+    std::vector<Block> sample;
+    for(size_t i=0; i < std::min(options.samples, total); ++i){
+        Block block;
+        chain.FindBlock(uint32_t(rng() % total), block);
+        sample.push_back(std::move(block));
+    }
+
+    {
+        Result hash { "CalculateBlockHash" };
+        for(Block& block : sample){
+            block.ClearCache();
+            Clock::time_point start = Clock::now();
+            chain.CalculateBlockHash(block);
+            hash.latency.Add(Elapsed(start));
+            hash.bytes += block.owner.size() + block.data.size() + block.signature.signature.size() + 3 * Sha256::Size;
+        }
+        results.push_back(std::move(hash));
+    }
+
+    {
+        Result sign { "SignBlock" };
+        Quiet(true);
+        for(Block block : sample){
+            block.signature = Signature();
+            block.ClearCache();
+            Clock::time_point start = Clock::now();
+            chain.SignBlock(block);
+            sign.latency.Add(Elapsed(start));
+        }
+        Quiet(false);
+        results.push_back(std::move(sign));
+    }
+
+    {
+        Result verify { "ValidateBlockSignature" };
+        Quiet(true);
+        for(const Block& block : sample){
+            Clock::time_point start = Clock::now();
+            chain.ValidateBlockSignature(block);
+            verify.latency.Add(Elapsed(start));
+        }
+        Quiet(false);
+        results.push_back(std::move(verify));
+    }
+
+    uint64_t fileSize = 0;
+    {
+        Result exportChain { "ExportBlockChain" };
+        exportChain.items = total;
+        for(size_t r=0; r < options.rounds; ++r){
+            Clock::time_point start = Clock::now();
+            bool saved = chain.ExportBlockChain(options.database);
+            exportChain.latency.Add(Elapsed(start));
+            if(!saved){
+                std::cerr << "failed to export " << options.database << "\n";
+                return 1;
+            }
+
+            std::ifstream file(options.database, std::ios::binary | std::ios::ate);
+            fileSize = file.tellg();
+            exportChain.bytes += fileSize;
+        }
+        results.push_back(std::move(exportChain));
+    }
+
+    {
+        Result importChain { "ImportBlockChain" };
+        importChain.items = total;
+        for(size_t r=0; r < options.rounds; ++r){
+            Blockchain loaded;
+            Quiet(true);
+            Clock::time_point start = Clock::now();
+            bool imported = loaded.ImportBlockChain(options.database, options.threads);
+            importChain.latency.Add(Elapsed(start));
+            Quiet(false);
+
+            if(!imported || loaded.GetBlockChainSize() != total){
+                std::cerr << "import accepted " << loaded.GetBlockChainSize() << " of " << total << " blocks\n";
+                return 1;
+            }
+            importChain.bytes += fileSize;
+        }
+        results.push_back(std::move(importChain));
+    }
+
+    {
+        Result find { "FindBlock" };
+        Block block;
+        for(size_t i=0; i < options.lookups; ++i){
+            uint32_t id = uint32_t(rng() % total);
+            Clock::time_point start = Clock::now();
+            chain.FindBlock(id, block);
+            find.latency.Add(Elapsed(start));
+        }
+        results.push_back(std::move(find));
+    }
+
+    { // batches stemming off earlier blocks, signed in parallel
+        Result create { "CreateBlocks" };
+        create.items = std::min(options.samples, total);
+        for(size_t r=0; r < options.rounds; ++r){
+            std::vector<BlockRequest> requests;
+            for(size_t i=0; i < create.items; ++i){
+                requests.push_back({ uint32_t(rng() % total), "", RandomPayload(rng, options.payload) });
+                create.bytes += options.payload;
+            }
+
+            Quiet(true);
+            Clock::time_point start = Clock::now();
+            bool created = chain.CreateBlocks(requests, "", options.threads);
+            create.latency.Add(Elapsed(start));
+            Quiet(false);
+
+            if(!created){
+                std::cerr << "failed to create a batch\n";
+                return 1;
+            }
+        }
+        results.push_back(std::move(create));
+    }
+
+    { // one producer per thread, each waiting for its block before submitting the next
+        Result submit { "SubmitBlock" };
+        size_t perThread = std::max<size_t>(1, std::min(options.samples, total) / options.threads);
+        std::vector<std::string> payloads;
+        for(size_t i=0; i < perThread * options.threads; ++i) payloads.push_back(RandomPayload(rng, options.payload));
+        std::vector<uint32_t> stems;
+        for(size_t i=0; i < payloads.size(); ++i) stems.push_back(uint32_t(rng() % total));
+
+        std::mutex merge;
+        std::atomic<size_t> failed(0);
+        Quiet(true);
+        chain.StartSubmissions("", options.threads);
+
+        std::vector<std::thread> producers;
+        for(unsigned t=0; t < options.threads; ++t){
+            producers.emplace_back([&, t] {
+                std::vector<double> latencies;
+                for(size_t i = t * perThread; i < (t + 1) * perThread; ++i){
+                    Clock::time_point start = Clock::now();
+                    if(chain.SubmitBlock(stems[i], "", payloads[i]).get() == UINT32_MAX) ++failed;
+                    latencies.push_back(Elapsed(start));
+                }
+
+                std::lock_guard<std::mutex> guard(merge);
+                for(double ns : latencies) submit.latency.Add(ns);
+            });
+        }
+        for(std::thread& producer : producers) producer.join();
+
+        chain.StopSubmissions();
+        Quiet(false);
+
+        if(failed > 0){
+            std::cerr << "failed to create " << failed << " submitted blocks\n";
+            return 1;
+        }
+        submit.bytes = payloads.size() * options.payload;
+        results.push_back(std::move(submit));
+    }
+
+    std::remove(options.database.c_str());
+
+    if(options.output.empty()){
+        WriteReport(std::cout, options, results);
+    } else {
+        std::ofstream out(options.output);
+        if(!out.is_open()){
+            std::cerr << "write file error\n";
+            return 1;
+        }
+        WriteReport(out, options, results);
+    }
+
+    return 0;
+}
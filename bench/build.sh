@@ -0,0 +1,67 @@
+#!/bin/bash
+
+# Builds the benchmark from the library sources (everything in src/ except main.cpp) and bench/
+# Run from the repository root: bench/build.sh
+
+CPP=g++
+GPP=g++
+OUTPUT="bench.elf"
+
+DEBUGMODE=0
+VERBOSE=0
+
+SOURCE_DIRECTORY="src"
+BENCH_DIRECTORY="bench"
+COMPILER_FLAGS="-std=c++20 -O2"
+ADDITIONAL_LIBRARIES="-static-libstdc++ -lpthread -ltomcrypt -ltommath"
+ADDITIONAL_LIBDIRS="-Llibraries/libtomcrypt-main/lib/linux"
+ADDITIONAL_INCLUDEDIRS="-Iinclude -Ilibraries/libtomcrypt-main/include"
+
+OBJ_DIR=".objsbench"
+
+if [ -f "$OUTPUT" ]; then
+    rm $OUTPUT
+fi
+
+if [ $DEBUGMODE -eq 1 ]; then
+    DEBUG_INFO="-ggdb -g"
+else
+    DEBUG_INFO="-s"
+fi
+
+if [ ! -d "$OBJ_DIR/" ]; then
+    echo "Creating Object Directory Structure..."
+    mkdir "$OBJ_DIR/"
+fi
+rm -f $OBJ_DIR/*.o
+
+echo "Building Benchmark Files..."
+procs=()
+cppfiles=$(find $SOURCE_DIRECTORY $BENCH_DIRECTORY -type f -name "*.cpp" ! -path "$SOURCE_DIRECTORY/main.cpp")
+
+for filename in $cppfiles; do
+    objfile="$(basename "$(dirname "$filename")")_$(basename "$filename" .cpp).o"
+    echo "Building $objfile"
+
+    if [ $VERBOSE -eq 1 ]; then
+        echo "$CPP $ADDITIONAL_INCLUDEDIRS $COMPILER_FLAGS $DEBUG_INFO -c $filename -o $OBJ_DIR/$objfile"
+    fi
+
+    $CPP $ADDITIONAL_INCLUDEDIRS $COMPILER_FLAGS $DEBUG_INFO -c $filename -o $OBJ_DIR/$objfile &
+    procs+=($!)
+done
+
+for pid in ${procs[*]}; do
+    wait $pid
+done
+
+echo "Linking Executable..."
+
+$GPP $ADDITIONAL_LIBDIRS -o $OUTPUT $OBJ_DIR/*.o $ADDITIONAL_LIBRARIES
+
+if [ -f "$OUTPUT" ]; then
+    echo "Build Complete"
+else
+    echo "Build Failed"
+    exit 1
+fi
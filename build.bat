@@ -25,7 +25,7 @@ set ASYNC_BUILD=1
 set SOURCE_DIRECTORIES=src
 set INCLUDE_DIRECTORIES=include
 set LIBRARY_DIRECTORIES=libraries\libtomcrypt-main
-set LIBRARY_NAMES=tomcrypt64 tommath64
+set LIBRARY_NAMES=tomcrypt64 tommath64 ws2_32
 
 :: Custom Library Support Directory Names
 set LIBRARY_DIRECTORY_NAME=lib\windows
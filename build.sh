@@ -14,6 +14,7 @@ VERBOSE=0
 ASYNC_BUILD=1
 
 SOURCE_DIRECTORY="src"
+TEST_DIRECTORY="tests"
 COMPILER_FLAGS="-std=c++20"
 ADDITIONAL_LIBRARIES="-static-libstdc++ -lpthread -ltomcrypt -ltommath"
 ADDITIONAL_LIBDIRS="-Llibraries/libtomcrypt-main/lib/linux"
@@ -21,6 +22,15 @@ ADDITIONAL_INCLUDEDIRS="-Iinclude -Ilibraries/libtomcrypt-main/include"
 
 OBJ_DIR=".objs64"
 
+# ./build.sh test builds tests.elf from the library sources (everything in src/ except main.cpp) and tests/, then runs it
+BUILD_TESTS=0
+if [ "$1" == "test" ]; then
+    BUILD_TESTS=1
+    OUTPUT="tests.elf"
+    OBJ_DIR=".objstest"
+    DEBUGMODE=1
+fi
+
 echo "------------------------"
 $GPP -v
 echo "------------------------"
@@ -48,7 +58,11 @@ if [ $LINK_ONLY -eq 0 ]; then
     echo "Building API Files..."
     procs=[]
     n=0
-    cppfiles=$(find $SOURCE_DIRECTORY -type f -name "*.cpp")
+    if [ $BUILD_TESTS -eq 1 ]; then
+        cppfiles=$(find $SOURCE_DIRECTORY $TEST_DIRECTORY -type f -name "*.cpp" ! -path "$SOURCE_DIRECTORY/main.cpp")
+    else
+        cppfiles=$(find $SOURCE_DIRECTORY -type f -name "*.cpp")
+    fi
 
     for filename in $cppfiles; do
         objfile="$(basename "$filename" .cpp)$n.o"
@@ -98,4 +112,11 @@ if [ -f "$OUTPUT" ]; then
     echo "Build Complete"
 else
     echo "Build Failed"
+    exit 1
+fi
+
+if [ $BUILD_TESTS -eq 1 ]; then
+    echo "Running Tests..."
+    ./$OUTPUT
+    exit $?
 fi
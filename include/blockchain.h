@@ -2,6 +2,9 @@
 
 #include "simple_pkc.h"
 #include "fileio.h"
+#include "chainstore.h"
+#include "transport.h"
+#include "workqueue.h"
 
 #include <vector>
 #include <string>
@@ -9,16 +12,37 @@
 #include <fstream>
 #include <sstream>
 #include <iomanip>
+#include <thread>
+#include <unordered_map>
+#include <shared_mutex>
+#include <future>
+#include <functional>
+#include <cstddef>
 
 #define FILE_ID         3489030000
-#define FILE_VERSION    100
+#define FILE_VERSION    400 // as FILE_VERSION_KEY_TABLE, with the signature algorithm of every block
+#define FILE_VERSION_KEY_TABLE 300 // as FILE_VERSION_INLINE_KEYS, with owner keys interned in a per-file key table, RSA-PSS only, read only
+#define FILE_VERSION_INLINE_KEYS 200 // little-endian fixed width fields, varint lengths, inline hashes, CRC32C per block, read only
+#define FILE_VERSION_LEGACY 100 // host size_t header and lengths, read only
+#define FILE_COUNT_OFFSET 8 // offset of the u64 block count in a current header
+#define CHECKPOINT_VERSION 1
+#define SYNC_VERSION 2
 
-struct FileHeader {
+enum class SyncMessage : uint8_t { Hello = 1, Reply, Blocks, End }; // first byte of every sync frame
+
+struct FileHeader { // legacy header layout
     size_t id, version, blockCount;
 };
 
+struct ChainScan {
+    uint64_t version;
+    size_t records, corrupt; // complete records / records failing their checksum
+    bool truncated; // a torn record was found at the end of the file
+};
+
 struct Signature {
     std::string hash, signature;
+    SignatureAlgorithm algorithm; // of the key that signed the block, covered by the hash unless RSA-PSS
 };
 
 struct Block {
@@ -31,48 +55,202 @@ struct Block {
     std::string data; // signed data
 
     Signature signature;
+
+    // memoized hashes; call ClearCache() after modifying a block that has been hashed
+    mutable std::string hashCache, signatureHashCache;
+    inline void ClearCache() { hashCache.clear(); signatureHashCache.clear(); }
+
+    BlockView View() const;
+};
+
+
+enum class BlockError {
+    None, // block is valid
+    NoParent, // previous block doesn't exist
+    BadRoot, // root hash doesn't match the chain name
+    BrokenChain, // previous block hash mismatch
+    BadKey, // owner key failed to import
+    HashMismatch, // signature hash isn't valid
+    BadSignature // signature failed verification
 };
 
+struct BlockRequest {
+    uint32_t stem; // id of the block to stem from, may be an earlier block of the same batch
+    std::string owner; // public key of the new owner, empty keeps the current user
+    std::string data;
+};
+
+struct Submission { // a queued SubmitBlock call
+    BlockRequest request;
+    std::promise<uint32_t> created; // id of the new block, UINT32_MAX if it was rejected or couldn't be saved
+};
 
 struct KeyPair {
     std::string publicKey, privateKey;
 };
 
-class Blockchain {
-    static Crypto rsa; // static RSA Crypto controller
+struct ImportProgress {
+    size_t parsed; // intact records handed to the pipeline
+    size_t accepted, rejected; // blocks resolved so far, in file order
+    bool done;
+};
+
+typedef std::function<void(const ImportProgress&)> ImportCallback;
+
+struct Checkpoint;
+
+struct BlockWeight {
+    uint32_t depth; // blocks between this one and the root
+    uint64_t work; // cumulative work of the branch ending here
+};
 
+class Blockchain {
     uint32_t nextid; // next global id
-    std::vector<Block> chain; // database of blocks
+    ChainStore chain; // database of blocks
+    std::vector<size_t> index; // block id -> position in chain
+    std::unordered_map<uint32_t, size_t> sparseIndex; // ids too far past the dense range
+    std::vector<std::vector<size_t>> ownerIndex; // owner key id -> positions of the blocks it owns
+    std::vector<std::vector<size_t>> childIndex; // position -> positions of the blocks stemming from it
+    std::vector<std::pair<uint64_t, size_t>> timeIndex; // (timestamp, position), sorted
+
+    std::vector<BlockWeight> weights; // position -> depth and cumulative work
+    std::vector<size_t> leaves; // positions of blocks nothing stems from yet
+    std::vector<size_t> leafSlots; // position -> slot in leaves, SIZE_MAX once it has children
+    size_t canonicalTip; // heaviest leaf, the first one seen on a tie
     std::string name; // name of blockchain
 
+    std::string persistPath; // file the chain was last loaded from or saved to
+    size_t persistedBlocks, persistedRecords; // blocks of chain already on disk / complete records in the file
+    uint64_t persistedSize; // end of the last complete record in the file
+    uint64_t persistedVersion; // format of that file
+    std::vector<uint32_t> persistedKeyIds; // store key id -> key id in that file, UINT32_MAX if not written yet
+    uint32_t persistedKeys; // keys defined in that file
+    bool persistedClean; // every record in that file was accepted
+
+    std::string checkpointPath; // trusted checkpoint consulted on import, empty for full verification
+    uint64_t checkpointRecords; // records covered by the checkpoint on disk
+
     KeyPair currentUser; // locally stored keys for current user
+    SigningSession signer; // parsed key of the current user
+    std::string signerPublic; // its public key as exported
+    bool signerStale; // the signer no longer holds the current user's key
+    KeyCache keys; // parsed owner keys
+    std::vector<CryptoKey> ownerKeys; // store key id -> parsed key, filled on first use
+
+    mutable std::shared_mutex chainLock; // held exclusively while a block is stored, shared by the queries
+    std::shared_future<bool> pendingImport; // background import, the chain may only be queried until it is ready
+
+    MpscQueue<Submission> submissions; // SubmitBlock -> sequencer
+    std::thread sequencer; // the only writer while it runs
+    std::atomic<bool> accepting {false}; // between StartSubmissions and StopSubmissions
+    std::atomic<size_t> submitters {0}; // SubmitBlock calls past the accepting check, close() waits for them
+    std::string submitPath; // appended after every batch, empty keeps blocks in memory
+    unsigned submitThreads; // signing pool size
+
+    // thread-safe, shares no key state; hashes are passed in precomputed, verify=false skips only the signature check
+    BlockError CheckBlock(const BlockView& block, std::string_view sigHash, const BlockView* prevBlock, std::string_view prevHash, bool verify=true, const CryptoKey& prevKey=CryptoKey());
+    BlockError CheckBlock(const BlockView& block, std::string_view sigHash, bool verify=true); // against the stored parent
+    size_t ValidateParallel(const std::vector<BlockView>& blocks, unsigned threads, size_t trusted); // validate parsed blocks on a worker pool
+    size_t LoadCheckpoint(const MappedFile& file, const std::vector<BlockView>& blocks, const std::vector<uint64_t>& recordEnds); // trusted prefix length
+    bool ReadCheckpoint(Checkpoint& checkpoint); // signed by the current user
+    bool ImportPipeline(const std::string& path, unsigned threads, const ImportCallback& progress);
+    void TrackPersistedKeys(const std::vector<std::string_view>& fileKeys); // after an import, map stored keys to the file's key ids
+    bool SigningKey(CryptoKey& key, std::string& publicKey);
+    void LoadSigner(); // parses the current user's key, once per change of keys
+    const std::string& PrepareSignature(Block& block, SignatureAlgorithm algorithm); // the hash to sign
+    void AttachSignature(Block& block, std::string&& signature);
+    void RunSequencer();
+    void SequenceBlocks(std::vector<Submission>& batch); // ids in queue order, signed together, one database append
+    const CryptoKey& OwnerKey(uint32_t keyId); // parsed key of an interned owner
+    bool WriteStoredRecord(DataManipulator& writer, size_t pos, std::vector<uint32_t>& fileKeyIds, uint32_t& fileKeys); // with a key reference
+    bool WriteBlockRecords(DataManipulator& writer, size_t from, std::vector<uint32_t>& fileKeyIds, uint32_t& fileKeys); // chain[from..]
+    bool WritePendingRecords(DataManipulator& writer, const std::vector<Block>& blocks, const std::vector<uint32_t>& fileKeyIds, uint32_t& fileKeys, std::unordered_map<std::string_view, uint32_t>& newKeys); // not stored yet
+    // writes the unsaved blocks and then blocks to path in one write (all of them if rewrite), and stores blocks only once
+    // that succeeded; a failed write leaves chain and file state as they were. An empty path just stores them
+    bool CommitBlocks(std::vector<Block>& blocks, const std::string& path, bool rewrite=false);
+    std::vector<size_t> Locator() const; // canonical branch, every block near the tip then exponentially sparser down to the root
+    size_t FindPosition(uint32_t id) const; // position in chain, SIZE_MAX if missing
+    void AppendBlock(const BlockView& block, std::string_view hash); // store a validated block and index it
+    void AppendBlock(Block&& block);
+    bool ClearBlocks(); // false while a snapshot of the chain is alive
 public:
     static size_t GetTimestamp();
-    static void PrintBlock(const Block& block);
+    static void PrintBlock(const BlockView& block);
+    static inline void PrintBlock(const Block& block) { PrintBlock(block.View()); }
     static std::string GenerateNonce();
 
+    // blocks as chain file records with a key table of their own, to answer queries over a transport
+    static bool EncodeBlocks(DataManipulator& writer, const std::vector<BlockView>& blocks);
+    static bool DecodeBlocks(DataManipulator& reader, std::vector<BlockView>& blocks); // the views point into the reader's buffer
+
     Blockchain();
     virtual ~Blockchain();
 
     void UpdateKeypair(const KeyPair& keypair);
     void SetCurrentKeypair(const KeyPair& keypair);
 
-    std::string CalculateBlockHash(const Block& block);
-    std::string CalculateBlockSignatureHash(const Block& block);
+    const std::string& CalculateBlockHash(const Block& block);
+    const std::string& CalculateBlockSignatureHash(const Block& block);
 
-    bool CreateBlock(const Block& prevBlock, const std::string& newOwner, const std::string& data);
+    bool CreateBlock(uint32_t stem, const std::string& newOwner, const std::string& data);
+    // all or nothing: the batch is appended to path in one write before any of it is stored, so a failed write leaves
+    // the chain unchanged; runs of blocks not stemming off each other are signed in parallel
+    bool CreateBlocks(const std::vector<BlockRequest>& requests, const std::string& path="", unsigned threads=1);
     bool SignBlock(Block& block);
     bool ValidateBlockSignature(const Block& block);
 
+    // any number of threads may submit; a sequencer drains the queue, assigns ids in submission order and signs
+    // everything drained at once on a pool of threads. Create no blocks directly between Start and Stop.
+    // Every future resolves: to the new id once the block is appended to path (if given) and then stored, or to UINT32_MAX
+    // when the block was rejected, the append to path kept failing, or no sequencer was running at submission.
+    // A batch is written before it is stored, so a block answered UINT32_MAX is in neither the chain nor the file.
+    // Ids are handed out before signing, so a block failing its signature or validation leaves a gap in the ids
+    bool StartSubmissions(const std::string& path="", unsigned threads=1);
+    std::future<uint32_t> SubmitBlock(uint32_t stem, const std::string& newOwner, const std::string& data); // lock-free
+    void StopSubmissions(); // the requests submitted before it are still answered
+
+    inline void SetSelfVerify(size_t every) { signer.VerifyEvery(every); } // check every nth own signature, 0 never, 1 always (default)
+
+    static bool ScanBlockChain(const std::string& path, ChainScan& scan); // checksum pass, no crypto
     bool ExportBlockChain(const std::string& path);
-    bool ImportBlockChain(const std::string& path);
-    bool GenerateNewBlockChain(const std::string& newName);
-    bool GenerateNewKeypair();
+    bool AppendBlockChain(const std::string& path); // appends unsaved blocks, falls back to a full export
+    bool ImportBlockChain(const std::string& path, unsigned threads=1);
+    // parse, hash and signature stages run on their own threads; blocks can be queried as soon as they are stored
+    // and progress is reported from the pipeline's thread. Don't modify the chain before the future is ready
+    std::shared_future<bool> ImportBlockChainAsync(const std::string& path, unsigned threads=1, ImportCallback progress=nullptr);
+
+    // peer sync: the client sends a sample of its canonical branch and its leaves, the server finds the common ancestor and
+    // streams every block that neither it nor a known leaf stems from as chain file records; the client verifies them as they arrive
+    bool ServeSync(Transport& peer); // answers one sync request, queries may run alongside
+    bool ServeSync(Transport& peer, std::string_view hello); // the request frame has been read already
+    bool SyncFrom(Transport& peer, unsigned threads=1); // pulls the blocks the peer has and this chain lacks
+
+    inline void UseCheckpoint(const std::string& path) { checkpointPath = path; } // empty forces full verification
+    bool WriteCheckpoint(const std::string& path); // signs the state of the chain file with the current user key
+    bool GenerateNewBlockChain(const std::string& newName, int keySize=256, SignatureAlgorithm algorithm=SignatureAlgorithm::RsaPss); // key size in bytes
+    bool GenerateNewKeypair(int size=256, SignatureAlgorithm algorithm=SignatureAlgorithm::RsaPss);
     
     bool ExportKeys(const std::string& pubPath, const std::string& privPath="");
     bool ImportKey(const std::string& path, int type);
 
+    // queries are safe while an asynchronous import is running
+    bool GetBlock(uint32_t id, BlockView& found) const; // O(1) lookup, the view lives as long as the chain
     bool FindBlock(uint32_t id, Block& found);
-    inline size_t GetBlockChainSize() const { return chain.size(); }
-    inline const std::vector<Block>& GetBlockChain() const { return chain; }
+
+    // fork tracking, every block is one unit of work so the heaviest branch is the longest
+    bool GetCanonicalTip(BlockView& tip) const; // O(1)
+    bool GetBlockWeight(uint32_t id, BlockWeight& weight) const;
+    std::vector<BlockView> GetLeaves() const;
+
+    // secondary index queries, results in chain order
+    std::vector<BlockView> FindByOwner(std::string_view owner) const;
+    std::vector<BlockView> FindChildren(uint32_t id) const;
+    std::vector<BlockView> FindInRange(uint64_t from, uint64_t to) const; // timestamps in [from, to]
+
+    inline void SetKeyCacheSize(size_t size) { keys.SetCapacity(size); }
+    inline KeyCacheStats GetKeyCacheStats() const { return keys.Stats(); }
+    inline size_t GetBlockChainSize() const { std::shared_lock<std::shared_mutex> guard(chainLock); return chain.size(); }
+    // lock-free snapshot of the blocks stored so far, blocks keep being added meanwhile; the chain can't be
+    // replaced by a new one while it is alive
+    inline ChainSnapshot GetBlockChain() const { return chain.Snapshot(); }
 };
\ No newline at end of file
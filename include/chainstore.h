@@ -0,0 +1,182 @@
+#pragma once
+
+#include "simple_pkc.h"
+
+#include <vector>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+
+struct SignatureView {
+    std::string_view hash, signature;
+    SignatureAlgorithm algorithm; // of the key that signed the block
+};
+
+struct Block;
+
+struct BlockView { // non-owning view of a block, e.g. into a mapped chain file or the chain store
+    std::string_view prevhash;
+    uint32_t id, previd;
+    uint64_t timestamp;
+    std::string_view nonce;
+
+    std::string_view owner;
+    std::string_view data;
+
+    SignatureView signature;
+
+    Block ToBlock() const; // owned copy
+};
+
+// append-only array kept in fixed size chunks, elements never move once written. One thread appends; others may read
+// elements whose writes were published to them (see ChainStore::size) without locks: they go through a chunk directory
+// that is replaced by a larger copy when full, and replaced directories stay allocated until clear()
+template<class T>
+class ChunkedArray {
+    static constexpr size_t ChunkBits = 12, ChunkSize = size_t(1) << ChunkBits;
+
+    std::vector<std::unique_ptr<T[]>> chunks;
+    std::vector<std::unique_ptr<T*[]>> directories; // every directory published, the last one current
+    std::atomic<T**> directory;
+    size_t slots, count; // of the current directory / elements written
+
+public:
+    ChunkedArray(): directory(nullptr), slots(0), count(0) {}
+
+    inline size_t size() const { return count; } // writer side
+    inline size_t capacity() const { return chunks.size() * ChunkSize; }
+    inline const T& operator[](size_t i) const { return directory.load(std::memory_order_acquire)[i >> ChunkBits][i & (ChunkSize - 1)]; }
+
+    void push_back(const T& value) {
+        size_t chunk = count >> ChunkBits;
+        if(chunk == chunks.size()){
+            chunks.emplace_back(new T[ChunkSize]);
+
+            if(chunk == slots){ // readers may still hold the full directory, it is retired rather than freed
+                size_t grown = std::max<size_t>(16, slots * 2);
+                std::unique_ptr<T*[]> next(new T*[grown]);
+                for(size_t c=0; c < chunk; ++c) next[c] = chunks[c].get();
+
+                directory.store(next.get(), std::memory_order_release);
+                directories.push_back(std::move(next));
+                slots = grown;
+            }
+            directories.back()[chunk] = chunks.back().get(); // nobody reads this slot before the element is published
+        }
+
+        chunks[chunk][count & (ChunkSize - 1)] = value;
+        ++count;
+    }
+
+    void clear() { // no reader may be left
+        directory.store(nullptr, std::memory_order_relaxed);
+        directories.clear();
+        chunks.clear();
+        slots = count = 0;
+    }
+};
+
+class Arena { // bump allocator for variable length fields, storage stays put until Clear()
+    static constexpr size_t ChunkSize = size_t(1) << 20;
+
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t used, available, reserved; // bytes used / left in the current chunk, bytes held overall
+
+public:
+    Arena();
+
+    std::string_view Store(std::string_view bytes);
+    void Clear();
+
+    inline size_t Reserved() const { return reserved; }
+};
+
+class ChainSnapshot;
+
+class ChainStore { // struct-of-arrays block storage: fixed fields in columns, payloads in an arena
+    ChunkedArray<uint32_t> ids, previds, owners; // owners hold key ids
+    ChunkedArray<uint64_t> timestamps;
+    ChunkedArray<Digest> prevhashes, hashes, signatureHashes;
+    ChunkedArray<std::string_view> nonces, datas, signatures;
+    ChunkedArray<SignatureAlgorithm> algorithms;
+    Arena arena;
+
+    ChunkedArray<std::string_view> keyTable; // interned owner keys, key id -> DER bytes in the arena
+    std::unordered_map<std::string_view, uint32_t> keyIds;
+
+    std::atomic<size_t> published {0}; // complete blocks, stored after every column of the last one
+
+    static constexpr size_t Clearing = size_t(1) << (sizeof(size_t) * 8 - 1); // readers flag while clear() runs
+    mutable std::atomic<size_t> readers {0}; // live snapshots
+
+    uint32_t InternKey(std::string_view key);
+
+public:
+    class iterator {
+        const ChainStore* store;
+        size_t pos;
+
+    public:
+        iterator(const ChainStore* store, size_t pos): store(store), pos(pos) {}
+
+        inline BlockView operator*() const { return (*store)[pos]; }
+        inline iterator& operator++() { ++pos; return *this; }
+        inline bool operator!=(const iterator& other) const { return pos != other.pos; }
+    };
+
+    // blocks below size() can be read from any thread while the owner appends more
+    inline size_t size() const { return published.load(std::memory_order_acquire); }
+    inline bool empty() const { return size() == 0; }
+
+    BlockView operator[](size_t pos) const; // views stay valid until clear()
+    inline BlockView back() const { return (*this)[size() - 1]; }
+
+    inline uint32_t Id(size_t pos) const { return ids[pos]; }
+    inline uint32_t PrevId(size_t pos) const { return previds[pos]; }
+    inline uint64_t Timestamp(size_t pos) const { return timestamps[pos]; }
+    inline uint32_t OwnerKey(size_t pos) const { return owners[pos]; } // equal keys have equal ids
+    inline std::string_view Hash(size_t pos) const { return hashes[pos].view(); }
+    inline std::string_view SignatureHash(size_t pos) const { return signatureHashes[pos].view(); }
+
+    inline size_t KeyCount() const { return keyTable.size(); } // key lookups aren't lock-free, the owner orders them with appends
+    inline std::string_view Key(uint32_t keyId) const { return keyTable[keyId]; }
+    bool FindKey(std::string_view key, uint32_t& keyId) const;
+
+    bool push_back(const BlockView& block, std::string_view hash); // hash fields must be 32 bytes
+    bool clear(); // false while a snapshot is alive, nothing is freed then
+
+    size_t MemoryUsage() const; // bytes held by the columns and the arena
+
+    inline iterator begin() const { return iterator(this, 0); }
+    inline iterator end() const { return iterator(this, size()); }
+
+    ChainSnapshot Snapshot() const; // the blocks stored so far
+
+    friend class ChainSnapshot;
+};
+
+class ChainSnapshot { // the blocks stored when it was taken, read without locks while more are appended; the store can't be cleared while one lives
+    const ChainStore* store;
+    size_t count;
+
+    explicit ChainSnapshot(const ChainStore* store); // empty if taken while the store is being cleared
+    friend class ChainStore;
+
+public:
+    ChainSnapshot(const ChainSnapshot& other);
+    ChainSnapshot& operator=(const ChainSnapshot& other);
+    ~ChainSnapshot();
+
+    inline size_t size() const { return count; }
+    inline bool empty() const { return count == 0; }
+    inline BlockView operator[](size_t pos) const { return (*store)[pos]; }
+    inline BlockView back() const { return (*store)[count - 1]; }
+
+    inline ChainStore::iterator begin() const { return ChainStore::iterator(store, 0); }
+    inline ChainStore::iterator end() const { return ChainStore::iterator(store, count); }
+};
+
+inline ChainSnapshot ChainStore::Snapshot() const { return ChainSnapshot(this); }
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "blockchain.h"
+#include "transport.h"
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <thread>
+
+// request frame: u8 request then its fields, answered by one frame: u8 DaemonStatus then the result.
+// On a local socket only its owner can connect; over TCP, AddBlock and Stop are denied until Auth presents the cookie
+enum class DaemonRequest : uint8_t { // clear of the SyncMessage values, sync requests share the port
+    AddBlock = 32, // u32 stem, varstring owner (empty keeps the current user), varstring data -> the new block
+    GetBlock, // u32 id -> the block, if any
+    GetChain, // u64 from (store position) -> u64 next position (0 after the last page), the blocks of a page
+    GetLeaves, // -> blocks nothing stems from
+    FindChildren, // u32 id -> blocks
+    FindByOwner, // varstring owner key -> blocks
+    FindInRange, // u64 from, u64 to -> blocks
+    Stats, // u8 prometheus -> varstring text
+    Stop, // -> nothing, the daemon exits once the answer is out
+    Auth // varstring cookie -> nothing, trusts the connection from then on
+};
+
+enum class DaemonStatus : uint8_t { Ok, Failed, BadRequest, Denied };
+
+class Daemon { // answers requests against a chain loaded once, a thread per connection; added blocks go through the chain's submission queue
+    struct Session {
+        std::unique_ptr<SocketTransport> peer;
+        std::thread worker;
+        std::atomic<bool> done {false};
+        bool trusted = false; // may add blocks and stop the daemon
+    };
+
+    Blockchain& chain;
+    std::string database; // created blocks are appended to it
+    unsigned threads; // signing pool
+    SocketListener listener;
+    std::string cookie, cookiePath; // secret written next to the database while listening on TCP
+    std::mutex sessionLock;
+    std::list<Session> sessions;
+
+    bool WriteCookie(); // readable by the daemon's user only
+    void Serve(Session& session);
+    void Answer(Session& session, std::string_view request, DataManipulator& reply);
+
+public:
+    // address is a port (0 picks a free one) or the path of a local socket
+    Daemon(Blockchain& chain, const std::string& database, const std::string& address, unsigned threads=1);
+    virtual ~Daemon();
+
+    Daemon(const Daemon&) = delete;
+    Daemon& operator=(const Daemon&) = delete;
+
+    inline bool IsOpen() const { return listener.IsOpen(); }
+    inline std::string Address() const { return listener.Address(); }
+
+    void Run(); // blocks until a Stop request or Stop()
+    void Stop(); // safe from any thread
+};
+
+typedef std::function<void(const std::vector<BlockView>& page)> BlockPageCallback; // views valid during the call only
+
+class DaemonClient { // one request at a time; the views returned point into the last answer
+    std::unique_ptr<SocketTransport> peer;
+    std::string answer;
+
+    bool Request(const DataManipulator& request, std::string_view& result); // Ok answers only, result follows the status
+    bool RequestBlocks(const DataManipulator& request, std::vector<BlockView>& found);
+
+public:
+    bool Connect(const std::string& address);
+    bool Authenticate(std::string_view cookie); // over TCP, before AddBlock or Stop
+
+    bool AddBlock(uint32_t stem, const std::string& newOwner, const std::string& data, BlockView& created);
+    bool GetBlock(uint32_t id, BlockView& found);
+    bool GetBlockChain(const BlockPageCallback& page); // page by page, in store order
+    bool GetLeaves(std::vector<BlockView>& found);
+    bool FindChildren(uint32_t id, std::vector<BlockView>& found);
+    bool FindByOwner(std::string_view owner, std::vector<BlockView>& found);
+    bool FindInRange(uint64_t from, uint64_t to, std::vector<BlockView>& found);
+    bool Stats(bool prometheus, std::string& text);
+    bool Stop();
+};
@@ -3,6 +3,50 @@
 #include <sstream>
 #include <memory>
 #include <cstring>
+#include <string>
+#include <string_view>
+
+class MappedFile { // read-only memory mapping of a whole file
+    const char* base;
+    size_t length;
+    bool open;
+
+#ifdef _WIN32
+    void *file, *mapping;
+#else
+    int fd;
+#endif
+
+public:
+    MappedFile(const std::string& path);
+    virtual ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    inline bool IsOpen() const { return open; }
+    inline const char* data() const { return base; }
+    inline size_t size() const { return length; }
+};
+
+uint32_t crc32c(const char* data, size_t size, uint32_t crc=0); // Castagnoli CRC, chainable
+
+class FileWriter { // unbuffered positional writes with durable flushes
+    int fd;
+
+public:
+    FileWriter(const std::string& path); // opens an existing file for update
+    virtual ~FileWriter();
+
+    FileWriter(const FileWriter&) = delete;
+    FileWriter& operator=(const FileWriter&) = delete;
+
+    inline bool IsOpen() const { return fd != -1; }
+
+    bool Truncate(uint64_t size);
+    bool WriteAt(uint64_t offset, const char* data, size_t size);
+    bool Sync(); // fsync, data is on disk once this returns true
+};
 
 class DataManipulator {
 
@@ -16,8 +60,35 @@ class DataManipulator {
 
 public:
     bool readString(std::string& rval);
+    bool readView(std::string_view& rval); // points into the source buffer, no copy
+    bool readView(std::string_view& rval, size_t size); // fixed size field
     bool writeString(const std::string& rval);
 
+    // compact encoding: LEB128 varint lengths, explicit little-endian integers
+    bool readVarint(uint64_t& rval);
+    bool readVarString(std::string& rval);
+    bool readVarView(std::string_view& rval);
+    bool writeVarint(uint64_t rval);
+    bool writeVarString(std::string_view rval);
+    bool writeBytes(const char* data, size_t size);
+
+    template<class T>
+    bool readLE(T& rval) {
+        uint8_t bytes[sizeof(T)];
+        if(!readData(bytes)) return false;
+
+        rval = 0;
+        for(size_t i=0; i < sizeof(T); ++i) rval |= T(bytes[i]) << (8 * i);
+        return true;
+    }
+
+    template<class T>
+    bool writeLE(T rval) {
+        uint8_t bytes[sizeof(T)];
+        for(size_t i=0; i < sizeof(T); ++i) bytes[i] = uint8_t(rval >> (8 * i));
+        return writeData(bytes);
+    }
+
 
     template<class T>
     bool readData(T& rval) {
@@ -51,9 +122,15 @@ public:
         return (stream << wdata->rdbuf()).good();
     }
 
+    inline std::string str() const { return readonly ? std::string() : wdata->str(); } // everything written so far
+
+    inline size_t tell() const { return pos; }
+    inline const char* at(size_t offset) const { return readonly ? rdata + offset : nullptr; }
+    inline size_t remaining() const { return readonly ? length - pos : 0; }
+
     DataManipulator(); // writer
     DataManipulator(const char* data, size_t length); // reader
 
-    virtual ~DataManipulator() {}
+    virtual ~DataManipulator();
 };
 
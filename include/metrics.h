@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Build with -DBLOCKCHAIN_METRICS=0 to compile the instrumentation out; the API stays and reports zeros
+#ifndef BLOCKCHAIN_METRICS
+#define BLOCKCHAIN_METRICS 1
+#endif
+
+enum class Counter {
+    HashCalls, HashBytes,
+    KeyImports, KeyImportFailures,
+    Signs, Verifies, VerifyFailures,
+    FileBytesRead, FileBytesWritten,
+    BlocksAccepted, BlocksRejected,
+    Count
+};
+
+enum class Timer {
+    Hash, KeyImport, Sign, Verify, FileRead, FileWrite,
+    Count
+};
+
+enum class Failure { // why a block was rejected
+    NoParent, BadRoot, BrokenChain, BadKey, HashMismatch, BadSignature, Checksum,
+    Count
+};
+
+struct HistogramSnapshot {
+    static constexpr size_t Buckets = 24; // bucket i counts durations below 2^(i+8) ns, the last one everything else
+
+    uint64_t count, totalNs;
+    uint64_t buckets[Buckets];
+};
+
+struct MetricsSnapshot {
+    uint64_t counters[size_t(Counter::Count)];
+    HistogramSnapshot timers[size_t(Timer::Count)];
+    uint64_t failures[size_t(Failure::Count)];
+};
+
+class Metrics { // process wide, lock-free counters and latency histograms
+    struct Histogram {
+        std::atomic<uint64_t> count, totalNs;
+        std::atomic<uint64_t> buckets[HistogramSnapshot::Buckets];
+    };
+
+    std::atomic<uint64_t> counters[size_t(Counter::Count)];
+    Histogram timers[size_t(Timer::Count)];
+    std::atomic<uint64_t> failures[size_t(Failure::Count)];
+
+    Metrics();
+
+public:
+    static Metrics& Global();
+
+    inline void Add(Counter counter, uint64_t value=1) { counters[size_t(counter)].fetch_add(value, std::memory_order_relaxed); }
+    inline void Add(Failure reason) { failures[size_t(reason)].fetch_add(1, std::memory_order_relaxed); }
+    void Record(Timer timer, uint64_t ns);
+
+    MetricsSnapshot Snapshot() const;
+    void Reset();
+
+    static const char* Name(Counter counter);
+    static const char* Name(Timer timer);
+    static const char* Name(Failure reason);
+
+    static std::string FormatText(const MetricsSnapshot& snapshot);
+    static std::string FormatPrometheus(const MetricsSnapshot& snapshot);
+};
+
+class ScopedTimer { // records the lifetime of the scope
+    Timer timer;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    ScopedTimer(Timer timer): timer(timer), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() {
+        Metrics::Global().Record(timer, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+};
+
+#define METRIC_CONCAT_(a, b) a##b
+#define METRIC_CONCAT(a, b) METRIC_CONCAT_(a, b)
+
+#if BLOCKCHAIN_METRICS
+#define METRIC_COUNT(counter, value) Metrics::Global().Add(Counter::counter, value)
+#define METRIC_FAILURE(reason) Metrics::Global().Add(reason)
+#define METRIC_TIMER(timer) ScopedTimer METRIC_CONCAT(metricTimer, __LINE__)(Timer::timer)
+#else
+#define METRIC_COUNT(counter, value) ((void)0)
+#define METRIC_FAILURE(reason) ((void)0)
+#define METRIC_TIMER(timer) ((void)0)
+#endif
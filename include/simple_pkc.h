@@ -4,27 +4,174 @@
 #include "tomcrypt.h"
 
 #include <string>
+#include <string_view>
+#include <memory>
 #include <algorithm>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <vector>
 
-class Crypto {
-    rsa_key keypair;
-    int prng_idx, hash_idx, salt_length;
+class Sha256 { // incremental SHA-256 over libtomcrypt's hash state
+    hash_state md;
+    uint64_t bytes; // hashed since the last reset
+
+public:
+    static constexpr size_t Size = 32;
+
+    Sha256();
+
+    void Reset();
+    void Update(const void* data, size_t size);
+    inline void Update(std::string_view data) { Update(data.data(), data.size()); }
+
+    template<class T>
+    inline void UpdateValue(const T& value) { Update(&value, sizeof(value)); } // raw bytes of a trivial value
+
+    inline uint64_t Hashed() const { return bytes; }
+
+    void Final(uint8_t (&out)[Size]); // finishes the digest and resets the state, uncounted by the metrics
+    std::string Final();
+};
+
+struct Digest { // fixed size SHA-256 output
+    uint8_t bytes[Sha256::Size];
+
+    inline std::string_view view() const { return std::string_view(reinterpret_cast<const char*>(bytes), sizeof(bytes)); }
+};
+
+enum class SignatureAlgorithm : uint8_t { // stored with every block, the values are part of the file format
+    RsaPss = 0, // legacy default
+    EcdsaP256 = 1
+};
+
+class SignatureScheme { // one signature algorithm over libtomcrypt; the built in schemes live in simple_pkc.cpp
+public:
+    class Key { // parsed key material of the scheme
+    public:
+        virtual ~Key() = default;
+
+        virtual bool IsPrivate() const = 0;
+        virtual std::string Export(int type) const = 0; // PK_PUBLIC or PK_PRIVATE
+        virtual std::string SignHash(std::string_view hash, int saltLength) const = 0;
+        virtual bool VerifyHash(std::string_view sighash, std::string_view hash, int saltLength) const = 0;
+        virtual const rsa_key* Rsa() const { return nullptr; } // for key encryption, RSA only
+    };
+
+    virtual ~SignatureScheme() = default;
+
+    virtual SignatureAlgorithm Algorithm() const = 0;
+    virtual const char* Name() const = 0;
+    virtual int Import(std::string_view der, std::unique_ptr<Key>& key) const = 0; // libtomcrypt error code
+    virtual int Generate(int size, std::unique_ptr<Key>& key) const = 0; // size in bytes, where the scheme has a choice
+
+    static const SignatureScheme* Find(SignatureAlgorithm algorithm); // nullptr for an unknown id
+    static const SignatureScheme* const* List(size_t& count); // every built in scheme, in detection order
+};
+
+class CryptoKey { // immutable handle to a parsed key; safe to share between threads
+    const SignatureScheme* scheme;
+    std::shared_ptr<const SignatureScheme::Key> key;
+
+    CryptoKey(const SignatureScheme* scheme, std::unique_ptr<SignatureScheme::Key>&& parsed);
+
+public:
+    CryptoKey(): scheme(nullptr) {}
+
+    static CryptoKey Import(std::string_view der); // detects the algorithm
+    static CryptoKey Import(std::string_view der, SignatureAlgorithm algorithm);
+    static CryptoKey Generate(int size=256, SignatureAlgorithm algorithm=SignatureAlgorithm::RsaPss);
+
+    inline bool IsValid() const { return key != nullptr; }
+    inline bool IsPrivate() const { return key != nullptr && key->IsPrivate(); }
+    inline SignatureAlgorithm Algorithm() const { return scheme ? scheme->Algorithm() : SignatureAlgorithm::RsaPss; }
+    inline const rsa_key* Rsa() const { return key ? key->Rsa() : nullptr; }
+
+    std::string ExportPublicKey() const;
+    std::string ExportPrivateKey() const;
+
+    std::string SignHash(std::string_view hash, int saltLength=8) const;
+    bool VerifyHash(std::string_view sighash, std::string_view hash, int saltLength=8) const;
+};
+
+struct KeyCacheStats {
+    size_t hits, misses, size, capacity;
+};
+
+class KeyCache { // thread-safe LRU of parsed keys keyed by the hash of their DER bytes
+    typedef std::pair<std::string, CryptoKey> Entry;
+
+    std::list<Entry> order; // most recently used at the front
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+    size_t capacity, hits, misses;
+    mutable std::mutex lock;
+
+public:
+    KeyCache(size_t capacity=256);
+
+    CryptoKey Get(std::string_view der); // parses and caches on a miss
+    CryptoKey Get(std::string_view der, SignatureAlgorithm algorithm); // invalid if the key is of another algorithm
+    void Clear();
+
+    void SetCapacity(size_t size); // 0 disables caching
+    KeyCacheStats Stats() const;
+};
+
+class SigningSession { // a private key parsed once and kept for many signatures; signing is thread-safe
+    CryptoKey key;
+    size_t verifyEvery; // self-check every nth signature, 0 never
+    std::atomic<size_t> count; // signatures made, drives the sampling
+
+public:
+    SigningSession(const CryptoKey& key=CryptoKey(), size_t verifyEvery=1);
+
+    void Reset(const CryptoKey& newKey); // not while signing
+    inline void VerifyEvery(size_t every) { verifyEvery = every; }
+    inline size_t VerifyEvery() const { return verifyEvery; }
+
+    inline bool IsValid() const { return key.IsPrivate(); }
+    inline const CryptoKey& Key() const { return key; }
+
+    std::string SignHash(std::string_view hash); // empty on a failure, including a failed self-check
+    std::vector<std::string> SignHashes(const std::vector<std::string_view>& hashes, unsigned threads=1); // in order
+};
+
+struct VerifyRequest { // one signature of a batch
+    std::string_view key; // DER of the signer's public key
+    SignatureAlgorithm algorithm;
+    std::string_view hash, signature;
+};
+
+class Crypto { // per-context crypto engine; the key it holds is never shared with other contexts
+    CryptoKey keypair;
+    int salt_length;
     bool error;
 
-    bool InitSystem();
+    static bool InitSystem();
 
 public:
     Crypto();
     virtual ~Crypto();
 
-    std::string sha256_hash(const std::string& data);
-    std::string prng_generate();
+    static bool System(); // registers the libtomcrypt descriptors once per process
+    static int HashIndex();
+    static int PrngIndex();
+
+    static std::string sha256_hash(std::string_view data);
+    static std::string prng_generate();
 
+    // checks every request, each distinct key is parsed once (through the cache when given) and
+    // its signatures are verified back to back; result i is set when request i verified
+    static std::vector<bool> VerifyBatch(const std::vector<VerifyRequest>& requests, unsigned threads=1, KeyCache* cache=nullptr, int saltLength=8);
 
-    bool GenerateKeypair(int size=256);
+
+    bool GenerateKeypair(int size=256, SignatureAlgorithm algorithm=SignatureAlgorithm::RsaPss);
     bool ImportKey(const std::string& key);
     void ClearKeys();
 
+    inline const CryptoKey& Key() const { return keypair; }
+
     std::string ExportPublicKey();
     std::string ExportPrivateKey();
 
@@ -39,4 +186,4 @@ public:
     inline void SaltLength(int length) { salt_length = length; }
     inline int SaltLength() const { return salt_length; }
 
-};
\ No newline at end of file
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+class Transport { // reliable, ordered byte stream to one peer
+public:
+    static constexpr size_t MaxFrame = size_t(64) << 20;
+
+    virtual ~Transport() = default;
+
+    virtual bool Send(const char* data, size_t size) = 0; // the whole buffer or false
+    virtual bool Receive(char* data, size_t size) = 0; // exactly size bytes, false once closed
+    virtual void Close() = 0; // safe from another thread, wakes a blocked Receive
+
+    // framing: u32 little-endian payload length, then the payload
+    bool SendFrame(std::string_view payload);
+    bool ReceiveFrame(std::string& payload, size_t limit=MaxFrame);
+};
+
+// an address is a port on 127.0.0.1, or (not on Windows) the path of a local socket
+class SocketTransport : public Transport { // connected stream socket
+    std::atomic<intptr_t> sock; // -1 once closed
+
+public:
+    explicit SocketTransport(intptr_t sock);
+    virtual ~SocketTransport();
+
+    SocketTransport(const SocketTransport&) = delete;
+    SocketTransport& operator=(const SocketTransport&) = delete;
+
+    static std::unique_ptr<SocketTransport> Connect(uint16_t port); // 127.0.0.1 only, nullptr on failure
+    static std::unique_ptr<SocketTransport> Connect(const std::string& address);
+
+    inline bool IsOpen() const { return sock != -1; }
+
+    bool Send(const char* data, size_t size) override;
+    bool Receive(char* data, size_t size) override;
+    void Close() override;
+};
+
+class SocketListener { // accepts connections on 127.0.0.1 or a local socket
+    std::atomic<intptr_t> sock; // -1 once closed
+    std::string path; // of the local socket, removed on close; empty for TCP
+
+    void Listen(uint16_t port);
+    void ListenLocal(const std::string& socketPath);
+
+public:
+    explicit SocketListener(uint16_t port); // 0 picks a free port
+    explicit SocketListener(const std::string& address); // a local socket is created accessible to its owner only
+    virtual ~SocketListener();
+
+    SocketListener(const SocketListener&) = delete;
+    SocketListener& operator=(const SocketListener&) = delete;
+
+    inline bool IsOpen() const { return sock != -1; }
+    inline bool IsLocal() const { return !path.empty(); } // only the owner can connect
+    uint16_t Port() const; // 0 for a local socket
+    std::string Address() const; // as taken by SocketTransport::Connect
+
+    std::unique_ptr<SocketTransport> Accept(); // blocks, nullptr once closed
+    void Close(); // safe from another thread, wakes a blocked Accept
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+
+template<class T>
+class BlockingQueue { // bounded multi-producer multi-consumer queue, pop fails once closed and drained
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+    std::mutex lock;
+    std::condition_variable notEmpty, notFull;
+
+public:
+    BlockingQueue(size_t capacity=64): capacity(capacity), closed(false) {}
+
+    bool push(T&& item) { // blocks while full, false once closed
+        std::unique_lock<std::mutex> guard(lock);
+        notFull.wait(guard, [this] { return closed || items.size() < capacity; });
+        if(closed) return false;
+
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) { // blocks while empty, false once closed and drained
+        std::unique_lock<std::mutex> guard(lock);
+        notEmpty.wait(guard, [this] { return closed || !items.empty(); });
+        if(items.empty()) return false;
+
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+};
+
+template<class T>
+class MpscQueue { // lock-free multi-producer single-consumer queue, producers never wait and the consumer takes everything queued at once
+    struct Node {
+        T item;
+        Node* next; // the one queued before
+        bool last; // close() marker
+    };
+
+    std::atomic<Node*> head; // newest first
+
+    void link(Node* node) {
+        Node* previous = head.load(std::memory_order_relaxed);
+        do {
+            node->next = previous;
+        } while(!head.compare_exchange_weak(previous, node, std::memory_order_release, std::memory_order_relaxed));
+
+        // node belongs to the consumer from here on, only the local copy may be looked at
+        if(previous == nullptr) head.notify_one(); // the consumer may be waiting for the first item
+    }
+
+public:
+    MpscQueue(): head(nullptr) {}
+    ~MpscQueue() { // unconsumed items are destroyed
+        std::vector<T> rest;
+        drain(rest);
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(T&& item) { link(new Node { std::move(item), nullptr, false }); }
+    void close() { link(new Node { T(), nullptr, true }); } // the consumer stops at it, later items are only destroyed
+
+    inline void wait() const { head.wait(nullptr, std::memory_order_acquire); } // consumer side, until anything is queued
+
+    bool drain(std::vector<T>& items) { // consumer side, appends oldest first; false once the close marker is reached
+        Node* node = head.exchange(nullptr, std::memory_order_acquire);
+
+        Node* oldest = nullptr; // reverse into queue order
+        while(node){
+            Node* next = node->next;
+            node->next = oldest;
+            oldest = node;
+            node = next;
+        }
+
+        bool open = true;
+        while(oldest){
+            Node* next = oldest->next;
+            if(oldest->last) open = false;
+            else if(open) items.push_back(std::move(oldest->item));
+            delete oldest;
+            oldest = next;
+        }
+        return open;
+    }
+};
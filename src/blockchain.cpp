@@ -1,22 +1,31 @@
 #include "blockchain.h"
+#include "workqueue.h"
+#include "metrics.h"
 
 #include <iostream>
 #include <algorithm>
 #include <chrono>
-
-Crypto Blockchain::rsa; // static rsa member
+#include <atomic>
+#include <unordered_map>
+#include <map>
+#include <deque>
 
 size_t Blockchain::GetTimestamp() { // static timestamp query
     return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
 std::string Blockchain::GenerateNonce() { // static nonce generator
-    return rsa.prng_generate();
+    return Crypto::prng_generate();
+}
+
+static const char* SignatureName(SignatureAlgorithm algorithm) {
+    const SignatureScheme* scheme = SignatureScheme::Find(algorithm);
+    return scheme ? scheme->Name() : "unknown";
 }
 
-void Blockchain::PrintBlock(const Block& block) { // static print block method
+void Blockchain::PrintBlock(const BlockView& block) { // static print block method
     std::stringstream owner, sighash, nonce;
-    for(uint8_t c : rsa.sha256_hash(block.owner)) owner << std::hex << std::setw(2) << std::setfill('0') << (int)c;
+    for(uint8_t c : Crypto::sha256_hash(block.owner)) owner << std::hex << std::setw(2) << std::setfill('0') << (int)c;
     for(uint8_t c : block.signature.hash) sighash << std::hex << std::setw(2) << std::setfill('0') << (int)c;
     for(uint8_t c : block.nonce) nonce << std::hex << std::setw(2) << std::setfill('0') << (int)c;
 
@@ -26,122 +35,407 @@ void Blockchain::PrintBlock(const Block& block) { // static print block method
               << "Owner: " << owner.str() << "\n"
               << "Data: " << block.data << "\n"
               << "Signature Hash: " << sighash.str() << "\n"
+              << "Signature Algorithm: " << SignatureName(block.signature.algorithm) << "\n"
               << "Nonce: " << nonce.str() << "\n";
 }
 
 
 
-Blockchain::Blockchain(): nextid(0) {
+Blockchain::Blockchain(): nextid(0), canonicalTip(SIZE_MAX), persistedBlocks(0), persistedRecords(0), persistedSize(0), persistedVersion(0),
+                          persistedKeys(0), persistedClean(false), checkpointRecords(0), signerStale(true), submitThreads(1) {
 
 }
 
 Blockchain::~Blockchain() {
-
+    StopSubmissions();
+    if(pendingImport.valid()) pendingImport.wait(); // the pipeline still refers to this chain
 }
 
 void Blockchain::UpdateKeypair(const KeyPair& keypair) {
-    rsa.ClearKeys();
-    if(!keypair.publicKey.empty()) rsa.ImportKey(keypair.publicKey);
-    if(!keypair.privateKey.empty()) rsa.ImportKey(keypair.privateKey);
+    CryptoKey key;
+    if(!keypair.publicKey.empty()) key = keys.Get(keypair.publicKey);
+    if(!keypair.privateKey.empty()) key = keys.Get(keypair.privateKey);
+
+    signer.Reset(key);
+    signerPublic = key.ExportPublicKey();
+    signerStale = true; // the next signature goes back to the current user
+}
+
+void Blockchain::LoadSigner() {
+    if(!signerStale) return;
+
+    UpdateKeypair(currentUser);
+    signerStale = false;
 }
 
 void Blockchain::SetCurrentKeypair(const KeyPair& keypair) {
     currentUser = keypair; // updates internal keypair for current user
+    signerStale = true;
 }
 
-std::string Blockchain::CalculateBlockHash(const Block& block) {
-    std::string rawdata;
-    
-    rawdata.append(reinterpret_cast<const char*>(&block.id), sizeof(block.id));
-    rawdata.append(reinterpret_cast<const char*>(&block.previd), sizeof(block.previd));
-    rawdata.append(reinterpret_cast<const char*>(&block.timestamp), sizeof(block.timestamp));
-    rawdata += block.prevhash + block.owner + block.nonce + block.data + block.signature.hash + block.signature.signature;
+BlockView Block::View() const {
+    return { prevhash, id, previd, timestamp, nonce, owner, data, { signature.hash, signature.signature, signature.algorithm } };
+}
 
-    return rsa.sha256_hash(rawdata);
+Block BlockView::ToBlock() const {
+    Block block {};
+    block.prevhash = prevhash;
+    block.id = id;
+    block.previd = previd;
+    block.timestamp = timestamp;
+    block.nonce = nonce;
+    block.owner = owner;
+    block.data = data;
+    block.signature.hash = signature.hash;
+    block.signature.signature = signature.signature;
+    block.signature.algorithm = signature.algorithm;
+    return block;
 }
 
-std::string Blockchain::CalculateBlockSignatureHash(const Block& block) {
-    Block copy(block);
-    copy.signature.hash.clear();
-    copy.signature.signature.clear();
+template<class B>
+static void HashBlockFields(const B& block, bool withSignature, Digest& out) {
+    METRIC_TIMER(Hash);
+    Sha256 md;
+
+    // same byte layout as the concatenated block, streamed without a copy
+    md.UpdateValue(block.id);
+    md.UpdateValue(block.previd);
+    md.UpdateValue(block.timestamp);
+    md.Update(block.prevhash);
+    md.Update(block.owner);
+    md.Update(block.nonce);
+    md.Update(block.data);
+    if(block.signature.algorithm != SignatureAlgorithm::RsaPss){ // left out for RSA-PSS so older blocks keep their hashes
+        md.UpdateValue(block.signature.algorithm);
+    }
+    if(withSignature){
+        md.Update(block.signature.hash);
+        md.Update(block.signature.signature);
+    }
+    METRIC_COUNT(HashCalls, 1);
+    METRIC_COUNT(HashBytes, md.Hashed());
+    md.Final(out.bytes);
+}
 
-    return CalculateBlockHash(copy);
+const std::string& Blockchain::CalculateBlockHash(const Block& block) {
+    if(block.hashCache.empty()){
+        Digest digest;
+        HashBlockFields(block, true, digest);
+        block.hashCache = digest.view();
+    }
+    return block.hashCache;
+}
+
+const std::string& Blockchain::CalculateBlockSignatureHash(const Block& block) {
+    if(block.signatureHashCache.empty()){
+        Digest digest;
+        HashBlockFields(block, false, digest);
+        block.signatureHashCache = digest.view();
+    }
+    return block.signatureHashCache;
 }
 
 bool Blockchain::SignBlock(Block& block) {
     if(!block.signature.hash.empty()) return false; // block already signed
 
-    UpdateKeypair(currentUser); // set key to current user
+    LoadSigner(); // set key to current user
 
-    Signature sig;
-    sig.hash = CalculateBlockSignatureHash(block);
-    sig.signature = rsa.SignHash(sig.hash);
+    std::string signature = signer.SignHash(PrepareSignature(block, signer.Key().Algorithm())); // self-checked as configured
+    if(signature.empty()) return false; // failed to sign block
 
-    if(sig.hash.empty() || sig.signature.empty() || !rsa.VerifyHash(sig.signature, sig.hash)){
-        return false; // failed to sign block
+    AttachSignature(block, std::move(signature));
+    return true;
+}
+
+const std::string& Blockchain::PrepareSignature(Block& block, SignatureAlgorithm algorithm) {
+    if(block.signature.algorithm != algorithm){
+        block.signature.algorithm = algorithm; // part of the signature hash
+        block.ClearCache();
     }
+    return CalculateBlockSignatureHash(block);
+}
 
-    block.signature = sig; // copy signature onto new block
-    return true;
+void Blockchain::AttachSignature(Block& block, std::string&& signature) {
+    block.signature.hash = CalculateBlockSignatureHash(block);
+    block.signature.signature = std::move(signature);
+    block.hashCache.clear(); // the signature hash doesn't cover the signature, only the full hash is stale
 }
 
-bool Blockchain::ValidateBlockSignature(const Block& block) {
-    rsa.ClearKeys();
+BlockError Blockchain::CheckBlock(const BlockView& block, std::string_view sigHash, const BlockView* prevBlock, std::string_view prevHash, bool verify, const CryptoKey& prevKey) {
+    CryptoKey key;
 
     if(block.id == 0){ // validate root block
-        if(rsa.sha256_hash(name) != block.prevhash) return false; // invalid root hash
+        if(Crypto::sha256_hash(name) != block.prevhash) return BlockError::BadRoot; // invalid root hash
 
-        if(!rsa.ImportKey(block.owner)){ // update public key to root owner
-            return false;
+        key = keys.Get(block.owner, block.signature.algorithm); // public key of root owner
+        if(!key.IsValid()){
+            return BlockError::BadKey;
         }
     } else {
-        Block prevBlock;
-        if(!FindBlock(block.previd, prevBlock)){
-            std::cout << "Previous block doesn't exist!\n";
-            return false; // no previous block
+        if(prevBlock == nullptr){
+            return BlockError::NoParent; // no previous block
         }
 
-        if(CalculateBlockHash(prevBlock) != block.prevhash){
-            return false; // broken chain
+        if(prevHash != block.prevhash){
+            return BlockError::BrokenChain; // broken chain
         }
 
-        if(!rsa.ImportKey(prevBlock.owner)){ // update public key
-            return false; // failed to import key
+        // public key of previous owner, which must be of the algorithm the block claims
+        key = (prevKey.IsValid() && prevKey.Algorithm() == block.signature.algorithm ? prevKey : keys.Get(prevBlock->owner, block.signature.algorithm));
+        if(!key.IsValid()){
+            return BlockError::BadKey; // failed to import key
         }
     }
 
-    if(block.signature.hash != CalculateBlockSignatureHash(block)){
-        std::cout << "Signature hash mismatch!\n";
-        return false; // signature hash isn't valid
+    if(block.signature.hash != sigHash){
+        return BlockError::HashMismatch; // signature hash isn't valid
+    }
+
+    if(verify && !key.VerifyHash(block.signature.signature, block.signature.hash)){
+        return BlockError::BadSignature;
+    }
+
+    return BlockError::None;
+}
+
+BlockError Blockchain::CheckBlock(const BlockView& block, std::string_view sigHash, bool verify) {
+    size_t pos = (block.id != 0 ? FindPosition(block.previd) : SIZE_MAX);
+    if(pos == SIZE_MAX) return CheckBlock(block, sigHash, nullptr, std::string_view(), verify);
+
+    BlockView parent = chain[pos];
+    return CheckBlock(block, sigHash, &parent, chain.Hash(pos), verify, OwnerKey(chain.OwnerKey(pos)));
+}
+
+const CryptoKey& Blockchain::OwnerKey(uint32_t keyId) {
+    if(keyId >= ownerKeys.size()) ownerKeys.resize(chain.KeyCount());
+    if(!ownerKeys[keyId].IsValid()) ownerKeys[keyId] = keys.Get(chain.Key(keyId)); // stays invalid on a bad key
+    return ownerKeys[keyId];
+}
+
+static void CountRejection(BlockError error) {
+    static const Failure reasons[] = { Failure::NoParent, Failure::NoParent, Failure::BadRoot, Failure::BrokenChain,
+                                       Failure::BadKey, Failure::HashMismatch, Failure::BadSignature };
+    METRIC_COUNT(BlocksRejected, 1);
+    METRIC_FAILURE(reasons[size_t(error)]);
+}
+
+static void CountChecksumFailure() {
+    METRIC_COUNT(BlocksRejected, 1);
+    METRIC_FAILURE(Failure::Checksum);
+}
+
+static bool ReportBlockError(BlockError error) {
+    switch(error){
+        case BlockError::None:
+            return true;
+        case BlockError::NoParent:
+            std::cout << "Previous block doesn't exist!\n";
+            return false;
+        case BlockError::HashMismatch:
+            std::cout << "Signature hash mismatch!\n";
+            return false;
+        default:
+            return false;
     }
+}
+
+bool Blockchain::ValidateBlockSignature(const Block& block) {
+    return ReportBlockError(CheckBlock(block.View(), CalculateBlockSignatureHash(block)));
+}
+
+size_t Blockchain::FindPosition(uint32_t id) const {
+    if(id < index.size() && index[id] != SIZE_MAX) return index[id];
+    if(sparseIndex.empty()) return SIZE_MAX;
+
+    auto it = sparseIndex.find(id);
+    return it == sparseIndex.end() ? SIZE_MAX : it->second;
+}
+
+bool Blockchain::GetBlock(uint32_t id, BlockView& found) const {
+    std::shared_lock<std::shared_mutex> guard(chainLock);
+    size_t pos = FindPosition(id);
+    if(pos == SIZE_MAX) return false;
 
-    return rsa.VerifyHash(block.signature.signature, block.signature.hash);
+    found = chain[pos];
+    return true;
 }
 
 bool Blockchain::FindBlock(uint32_t id, Block& found) {
-    auto it = std::find_if(chain.begin(), chain.end(), [&](const Block& block) -> bool {
-        return block.id == id;
-    });
-    if(it == chain.end()) return false;
+    std::shared_lock<std::shared_mutex> guard(chainLock);
+    size_t pos = FindPosition(id);
+    if(pos == SIZE_MAX) return false;
+
+    found = chain[pos].ToBlock();
+    found.hashCache = chain.Hash(pos);
+    found.signatureHashCache = chain.SignatureHash(pos);
+    return true;
+}
 
-    found = *it;
+void Blockchain::AppendBlock(Block&& block) {
+    AppendBlock(block.View(), CalculateBlockHash(block)); // the store keeps its own copy of every field
+}
+
+void Blockchain::AppendBlock(const BlockView& block, std::string_view hash) {
+    std::unique_lock<std::shared_mutex> guard(chainLock);
+
+    uint32_t id = block.id;
+    bool indexed = (FindPosition(id) != SIZE_MAX); // first block with an id wins, as with a linear scan
+    size_t pos = chain.size();
+    if(!chain.push_back(block, hash)) return; // validated blocks always carry 32 byte hashes
+    METRIC_COUNT(BlocksAccepted, 1);
+
+    uint32_t keyId = chain.OwnerKey(pos);
+    if(keyId >= ownerIndex.size()) ownerIndex.resize(size_t(keyId) + 1);
+    ownerIndex[keyId].push_back(pos);
+
+    childIndex.emplace_back();
+    size_t parent = (id != 0 ? FindPosition(block.previd) : SIZE_MAX);
+    if(parent != SIZE_MAX) childIndex[parent].push_back(pos);
+
+    BlockWeight weight { 0, 1 };
+    if(parent != SIZE_MAX){
+        weight = { weights[parent].depth + 1, weights[parent].work + 1 };
+
+        size_t slot = leafSlots[parent];
+        if(slot != SIZE_MAX){ // the parent stops being a leaf
+            leaves[slot] = leaves.back();
+            leafSlots[leaves[slot]] = slot;
+            leaves.pop_back();
+            leafSlots[parent] = SIZE_MAX;
+        }
+    }
+    weights.push_back(weight);
+    leafSlots.push_back(leaves.size());
+    leaves.push_back(pos);
+    if(canonicalTip == SIZE_MAX || weight.work > weights[canonicalTip].work) canonicalTip = pos;
+
+    // blocks mostly arrive in timestamp order, so this is an append in the common case
+    auto time = std::upper_bound(timeIndex.begin(), timeIndex.end(), std::make_pair(block.timestamp, pos));
+    timeIndex.emplace(time, block.timestamp, pos);
+
+    if(indexed) return;
+
+    // ids are handed out sequentially, so a dense table covers the chain;
+    // an id far past the end (e.g. from a hostile file) goes to the sparse map instead
+    if(id < index.size()){
+        index[id] = pos;
+    } else if(id - index.size() < 4096){
+        index.resize(size_t(id) + 1, SIZE_MAX);
+        index[id] = pos;
+    } else {
+        sparseIndex.emplace(id, pos);
+    }
+}
+
+bool Blockchain::ClearBlocks() {
+    std::unique_lock<std::shared_mutex> guard(chainLock);
+
+    if(!chain.clear()){
+        std::cout << "The blockchain is still being read, it can't be replaced\n";
+        return false;
+    }
+    index.clear();
+    sparseIndex.clear();
+    ownerIndex.clear();
+    childIndex.clear();
+    timeIndex.clear();
+    weights.clear();
+    leaves.clear();
+    leafSlots.clear();
+    canonicalTip = SIZE_MAX;
+    ownerKeys.clear();
+    return true;
+}
+
+bool Blockchain::GetCanonicalTip(BlockView& tip) const {
+    std::shared_lock<std::shared_mutex> guard(chainLock);
+    if(canonicalTip == SIZE_MAX) return false;
+
+    tip = chain[canonicalTip];
     return true;
 }
 
-bool Blockchain::CreateBlock(const Block& prevBlock, const std::string& newOwner, const std::string& data) {
+bool Blockchain::GetBlockWeight(uint32_t id, BlockWeight& weight) const {
+    std::shared_lock<std::shared_mutex> guard(chainLock);
+    size_t pos = FindPosition(id);
+    if(pos == SIZE_MAX) return false;
+
+    weight = weights[pos];
+    return true;
+}
+
+std::vector<BlockView> Blockchain::GetLeaves() const {
+    std::shared_lock<std::shared_mutex> guard(chainLock);
+    std::vector<size_t> positions(leaves);
+    std::sort(positions.begin(), positions.end());
+
+    std::vector<BlockView> found;
+    found.reserve(positions.size());
+    for(size_t pos : positions) found.push_back(chain[pos]);
+    return found;
+}
+
+std::vector<BlockView> Blockchain::FindByOwner(std::string_view owner) const {
+    std::shared_lock<std::shared_mutex> guard(chainLock);
+    std::vector<BlockView> found;
+    uint32_t keyId;
+    if(!chain.FindKey(owner, keyId) || keyId >= ownerIndex.size()) return found;
+
+    found.reserve(ownerIndex[keyId].size());
+    for(size_t pos : ownerIndex[keyId]) found.push_back(chain[pos]);
+    return found;
+}
+
+std::vector<BlockView> Blockchain::FindChildren(uint32_t id) const {
+    std::shared_lock<std::shared_mutex> guard(chainLock);
+    std::vector<BlockView> found;
+    size_t parent = FindPosition(id);
+    if(parent == SIZE_MAX) return found;
+
+    found.reserve(childIndex[parent].size());
+    for(size_t pos : childIndex[parent]) found.push_back(chain[pos]);
+    return found;
+}
+
+std::vector<BlockView> Blockchain::FindInRange(uint64_t from, uint64_t to) const {
+    std::shared_lock<std::shared_mutex> guard(chainLock);
+    std::vector<BlockView> found;
+    if(from > to) return found;
+
+    auto first = std::lower_bound(timeIndex.begin(), timeIndex.end(), std::make_pair(from, size_t(0)));
+    auto last = std::upper_bound(first, timeIndex.end(), std::make_pair(to, SIZE_MAX));
+
+    std::vector<size_t> positions;
+    positions.reserve(last - first);
+    for(auto it = first; it != last; ++it) positions.push_back(it->second);
+    std::sort(positions.begin(), positions.end());
+
+    found.reserve(positions.size());
+    for(size_t pos : positions) found.push_back(chain[pos]);
+    return found;
+}
+
+bool Blockchain::CreateBlock(uint32_t stem, const std::string& newOwner, const std::string& data) {
     std::string owner(newOwner);
 
-    if(!ValidateBlockSignature(prevBlock)){ // cannot stem off an invalid block
+    size_t pos = FindPosition(stem);
+    if(pos == SIZE_MAX){
+        std::cout << "Stem block doesn't exist\n";
+        return false;
+    }
+
+    BlockView prevBlock = chain[pos];
+    if(!ReportBlockError(CheckBlock(prevBlock, chain.SignatureHash(pos)))){ // cannot stem off an invalid block
         std::cout << "Stem block is invalid\n";
         return false;
     }
 
-    UpdateKeypair(currentUser); // set key to current user
+    LoadSigner(); // set key to current user
 
-    if(owner.empty()) owner = rsa.ExportPublicKey(); // if no new owner, ownership will not change
+    if(owner.empty()) owner = signerPublic; // if no new owner, ownership will not change
     
     Block newBlock {}; // default construct
-    newBlock.prevhash = CalculateBlockHash(prevBlock);
+    newBlock.prevhash = chain.Hash(pos);
     newBlock.timestamp = GetTimestamp();
     newBlock.nonce = GenerateNonce();
     newBlock.id = nextid;
@@ -154,28 +448,266 @@ bool Blockchain::CreateBlock(const Block& prevBlock, const std::string& newOwner
         return false;
     }
 
-    if(!ValidateBlockSignature(newBlock)){ // validate newly signed block to make sure it was signed with a valid key
+    // a stem owned by these very key bytes needs no second verification, the signer's self-check covers the signature
+    bool owned = (prevBlock.owner == signerPublic);
+    if(!ReportBlockError(CheckBlock(newBlock.View(), CalculateBlockSignatureHash(newBlock), &prevBlock, chain.Hash(pos), !owned))){
         std::cout << "New block failed to be validated. This could be because the new block was signed by the incorrect key\n";
         return false;
     }
 
     ++nextid;
-    chain.emplace_back(newBlock);
+    AppendBlock(std::move(newBlock));
+    return true;
+}
+
+bool Blockchain::CreateBlocks(const std::vector<BlockRequest>& requests, const std::string& path, unsigned threads) {
+    if(requests.empty()) return true;
+
+    LoadSigner(); // one key import for the whole batch
+    if(!signer.IsValid()){
+        std::cout << "No private key to sign with\n";
+        return false;
+    }
+    const SignatureAlgorithm algorithm = signer.Key().Algorithm();
+
+    std::vector<Block> batch;
+    batch.reserve(requests.size());
+    std::unordered_map<uint32_t, bool> stems; // stored stems already checked
+    size_t signedCount = 0; // leading blocks of the batch that are signed
+
+    // signs the blocks added since the last call in one go; a block stemming off one of them needs its
+    // parent's full hash, which covers the signature, so the run ends there
+    auto signPending = [&]() -> bool {
+        std::vector<std::string_view> hashes;
+        for(size_t b = signedCount; b < batch.size(); ++b) hashes.push_back(PrepareSignature(batch[b], algorithm));
+
+        std::vector<std::string> signatures = signer.SignHashes(hashes, threads);
+        for(size_t k=0; k < signatures.size(); ++k){
+            if(signatures[k].empty()){
+                std::cout << "New block failed the signature\n";
+                return false;
+            }
+            AttachSignature(batch[signedCount + k], std::move(signatures[k]));
+        }
+
+        signedCount = batch.size();
+        return true;
+    };
+
+    for(const BlockRequest& request : requests){
+        uint32_t id = nextid + batch.size();
+        std::string_view prevHash;
+
+        if(request.stem >= nextid && request.stem < id){ // stems off a block of this batch
+            if(request.stem - nextid >= signedCount && !signPending()) return false;
+            prevHash = CalculateBlockHash(batch[request.stem - nextid]);
+        } else {
+            size_t pos = FindPosition(request.stem);
+            if(pos == SIZE_MAX){
+                std::cout << "Stem block [" << request.stem << "] doesn't exist\n";
+                return false;
+            }
+
+            auto checked = stems.find(request.stem);
+            if(checked == stems.end()) checked = stems.emplace(request.stem, ReportBlockError(CheckBlock(chain[pos], chain.SignatureHash(pos)))).first;
+            if(!checked->second){ // cannot stem off an invalid block
+                std::cout << "Stem block [" << request.stem << "] is invalid\n";
+                return false;
+            }
+            prevHash = chain.Hash(pos);
+        }
+
+        Block newBlock {}; // default construct
+        newBlock.prevhash = prevHash;
+        newBlock.timestamp = GetTimestamp();
+        newBlock.nonce = GenerateNonce();
+        newBlock.id = id;
+        newBlock.previd = request.stem;
+        newBlock.owner = request.owner.empty() ? signerPublic : request.owner;
+        newBlock.data = request.data;
+
+        batch.emplace_back(std::move(newBlock));
+    }
+
+    if(!signPending()) return false;
+
+    // validate the batch against its stems before anything is committed
+    for(const Block& block : batch){
+        BlockView parent;
+        std::string_view parentHash;
+        if(block.previd >= nextid){
+            parent = batch[block.previd - nextid].View();
+            parentHash = CalculateBlockHash(batch[block.previd - nextid]);
+        } else {
+            size_t pos = FindPosition(block.previd);
+            parent = chain[pos];
+            parentHash = chain.Hash(pos);
+        }
+
+        // as in CreateBlock, only a stem owned by other key bytes needs the signature verified here
+        bool owned = (parent.owner == signerPublic);
+        if(CheckBlock(block.View(), CalculateBlockSignatureHash(block), &parent, parentHash, !owned) != BlockError::None){
+            std::cout << "New block [" << block.id << "] failed to be validated. This could be because it was signed by the incorrect key\n";
+            return false;
+        }
+    }
+
+    // written ahead of being stored: if the write fails the chain doesn't change and the ids are handed out again
+    if(!CommitBlocks(batch, path)) return false;
+
+    nextid += batch.size();
     return true;
 }
 
-bool Blockchain::GenerateNewBlockChain(const std::string& newName) {
-    if(!GenerateNewKeypair()){
+static const int SubmitAppendAttempts = 3; // per batch, before its callers are told it failed
+
+bool Blockchain::StartSubmissions(const std::string& path, unsigned threads) {
+    if(sequencer.joinable()) return false;
+
+    submitPath = path;
+    submitThreads = std::max(1u, threads);
+    sequencer = std::thread(&Blockchain::RunSequencer, this);
+    accepting = true;
+    return true;
+}
+
+std::future<uint32_t> Blockchain::SubmitBlock(uint32_t stem, const std::string& newOwner, const std::string& data) {
+    Submission submission { { stem, newOwner, data }, std::promise<uint32_t>() };
+    std::future<uint32_t> created = submission.created.get_future();
+
+    ++submitters; // announced before the check, so StopSubmissions can't close the queue under this push
+    if(!accepting){
+        --submitters;
+        std::cout << "Block submissions aren't running\n";
+        submission.created.set_value(UINT32_MAX);
+        return created;
+    }
+    submissions.push(std::move(submission));
+    --submitters;
+    return created;
+}
+
+void Blockchain::StopSubmissions() {
+    if(!sequencer.joinable()) return;
+
+    accepting = false;
+    while(submitters != 0) std::this_thread::yield(); // pushes already past the check land before the close marker
+    submissions.close();
+    sequencer.join();
+}
+
+void Blockchain::RunSequencer() {
+    std::vector<Submission> batch;
+    for(bool open = true; open;){
+        submissions.wait();
+        open = submissions.drain(batch);
+        if(!batch.empty()) SequenceBlocks(batch);
+        batch.clear();
+    }
+}
+
+void Blockchain::SequenceBlocks(std::vector<Submission>& batch) {
+    std::vector<uint32_t> created(batch.size(), UINT32_MAX);
+
+    LoadSigner(); // once per batch
+    if(!signer.IsValid()){
+        std::cout << "No private key to sign with\n";
+        for(Submission& submission : batch) submission.created.set_value(UINT32_MAX);
+        return;
+    }
+    const SignatureAlgorithm algorithm = signer.Key().Algorithm();
+
+    // callers only learn ids once their blocks are stored, so every stem is a stored block
+    std::vector<Block> blocks;
+    std::vector<size_t> origins, parents; // submission answered / stored stem of each block
+    std::unordered_map<uint32_t, bool> stems; // stems already checked
+    for(size_t i=0; i < batch.size(); ++i){
+        const BlockRequest& request = batch[i].request;
+        size_t pos = FindPosition(request.stem);
+        if(pos == SIZE_MAX){
+            std::cout << "Stem block [" << request.stem << "] doesn't exist\n";
+            continue;
+        }
+
+        auto checked = stems.find(request.stem);
+        if(checked == stems.end()) checked = stems.emplace(request.stem, ReportBlockError(CheckBlock(chain[pos], chain.SignatureHash(pos)))).first;
+        if(!checked->second){ // cannot stem off an invalid block
+            std::cout << "Stem block [" << request.stem << "] is invalid\n";
+            continue;
+        }
+
+        Block newBlock {}; // default construct
+        newBlock.prevhash = chain.Hash(pos);
+        newBlock.timestamp = GetTimestamp();
+        newBlock.nonce = GenerateNonce();
+        newBlock.id = nextid + blocks.size();
+        newBlock.previd = request.stem;
+        newBlock.owner = request.owner.empty() ? signerPublic : request.owner;
+        newBlock.data = request.data;
+
+        blocks.emplace_back(std::move(newBlock));
+        origins.push_back(i);
+        parents.push_back(pos);
+    }
+
+    std::vector<std::string_view> hashes;
+    hashes.reserve(blocks.size());
+    for(Block& block : blocks) hashes.push_back(PrepareSignature(block, algorithm));
+    std::vector<std::string> signatures = signer.SignHashes(hashes, submitThreads);
+
+    std::vector<Block> accepted;
+    std::vector<size_t> answered; // submission of each accepted block
+    for(size_t k=0; k < blocks.size(); ++k){
+        Block& block = blocks[k];
+        if(signatures[k].empty()){
+            std::cout << "New block [" << block.id << "] failed the signature\n";
+            continue;
+        }
+        AttachSignature(block, std::move(signatures[k]));
+
+        // as in CreateBlock, only a stem owned by other key bytes needs the signature verified here
+        BlockView parent = chain[parents[k]];
+        bool owned = (parent.owner == signerPublic);
+        if(CheckBlock(block.View(), CalculateBlockSignatureHash(block), &parent, chain.Hash(parents[k]), !owned) != BlockError::None){
+            std::cout << "New block [" << block.id << "] failed to be validated. This could be because it was signed by the incorrect key\n";
+            continue;
+        }
+
+        answered.push_back(origins[k]);
+        accepted.push_back(std::move(block));
+    }
+
+    // written ahead of being stored, so an id is only handed out for a block that is both stored and on disk
+    bool saved = accepted.empty();
+    for(int attempt=0; attempt < SubmitAppendAttempts && !saved; ++attempt){
+        if(attempt > 0) std::this_thread::sleep_for(std::chrono::milliseconds(100 << attempt));
+        saved = CommitBlocks(accepted, submitPath); // a failed write leaves chain and file as they were, so it can be repeated
+    }
+
+    if(saved){
+        for(size_t k=0; k < accepted.size(); ++k) created[answered[k]] = accepted[k].id;
+        nextid += blocks.size(); // the id of a block failing after it was signed stays unused
+    } else { // nothing was stored, the ids are handed out again
+        std::cout << "Failed export blockchain database, " << accepted.size() << " submitted blocks were dropped\n";
+    }
+
+    for(size_t i=0; i < batch.size(); ++i) batch[i].created.set_value(created[i]);
+}
+
+bool Blockchain::GenerateNewBlockChain(const std::string& newName, int keySize, SignatureAlgorithm algorithm) {
+    if(!ClearBlocks()) return false; // before the keys change, so a refused clear leaves the old chain usable
+
+    if(!GenerateNewKeypair(keySize, algorithm)){
         std::cout << "failed to generate keypair\n";
         return false;
     }
 
-    chain.clear();
     nextid = 1;
     name = newName;
+    persistPath.clear(); // nothing of the new chain is on disk yet
 
     Block rootBlock {}; // default construct
-    rootBlock.prevhash = rsa.sha256_hash(name);
+    rootBlock.prevhash = Crypto::sha256_hash(name);
     rootBlock.timestamp = GetTimestamp();
     rootBlock.nonce = GenerateNonce();
     rootBlock.owner = currentUser.publicKey;
@@ -184,19 +716,20 @@ bool Blockchain::GenerateNewBlockChain(const std::string& newName) {
     
     if(!SignBlock(rootBlock)) return false; // failed to sign root block
 
-    chain.push_back(rootBlock);
+    AppendBlock(std::move(rootBlock));
 
     return true;
 }
 
-bool Blockchain::GenerateNewKeypair() {
+bool Blockchain::GenerateNewKeypair(int size, SignatureAlgorithm algorithm) {
     // Generate New KeyPair
     KeyPair newkeys;
-    if(!rsa.GenerateKeypair()) return false; // failed to generate keypair
+    CryptoKey key = CryptoKey::Generate(size, algorithm);
+    if(!key.IsValid()) return false; // failed to generate keypair
 
     // Export keys
-    newkeys.publicKey = rsa.ExportPublicKey();
-    newkeys.privateKey = rsa.ExportPrivateKey();
+    newkeys.publicKey = key.ExportPublicKey();
+    newkeys.privateKey = key.ExportPrivateKey();
 
     SetCurrentKeypair(newkeys); // update blockchain default keypair for this session
 
@@ -251,117 +784,1183 @@ bool Blockchain::ImportKey(const std::string& path, int type) {
         default:
             return false;
     }
+    signerStale = true;
 
-    return rsa.ImportKey(key);
+    return CryptoKey::Import(key).IsValid();
 }
 
-bool Blockchain::ExportBlockChain(const std::string& path) {
+static bool WriteBlockRecord(DataManipulator& writer, const BlockView& block, uint32_t keyRef) { // keyRef 0 defines the owner key
+    if(block.prevhash.size() != Sha256::Size || block.signature.hash.size() != Sha256::Size){
+        std::cout << "Block [" << block.id << "] has a malformed hash field\n";
+        return false;
+    }
 
-    DataManipulator writer;
-    
-    FileHeader header;
-    header.id = FILE_ID;
-    header.version = FILE_VERSION;
-    header.blockCount = GetBlockChainSize();
+    DataManipulator record;
+    record.writeLE(block.id);
+    record.writeLE(block.previd);
+    record.writeLE(block.timestamp);
 
-    writer.writeData(header);
-    
-    writer.writeString(name);
+    record.writeBytes(block.prevhash.data(), Sha256::Size);
+    record.writeVarint(keyRef);
+    if(keyRef == 0) record.writeVarString(block.owner);
+    record.writeVarString(block.nonce);
+    record.writeVarString(block.data);
 
-    for(const Block& block : chain){
-        writer.writeData(block.id);
-        writer.writeData(block.previd);
-        writer.writeData(block.timestamp);
+    record.writeBytes(block.signature.hash.data(), Sha256::Size);
+    record.writeLE(uint8_t(block.signature.algorithm));
+    record.writeVarString(block.signature.signature);
 
-        writer.writeString(block.prevhash);
-        writer.writeString(block.owner);
-        writer.writeString(block.nonce);
-        writer.writeString(block.data);
+    std::stringstream recordbuffer;
+    if(!record.exportData(recordbuffer)) return false;
+    const std::string& bytes = recordbuffer.str();
 
-        writer.writeString(block.signature.hash);
-        writer.writeString(block.signature.signature);
-    }
+    writer.writeBytes(bytes.data(), bytes.size());
+    return writer.writeLE(crc32c(bytes.data(), bytes.size()));
+}
 
-    std::stringstream filebuffer;
-    if(!writer.exportData(filebuffer)) return false;
+static bool ReadLegacyRecord(DataManipulator& reader, BlockView& block) {
+    bool valid = true;
 
-    std::ofstream file(path, std::ios::out | std::ios::binary);
-    if(!file.is_open()){
-        std::cout << "write file error\n";
-        return false;
-    }
+    valid &= reader.readData(block.id);
+    valid &= reader.readData(block.previd);
+    valid &= reader.readData(block.timestamp);
 
-    bool result = (file << filebuffer.rdbuf()).good();
+    valid &= reader.readView(block.prevhash);
+    valid &= reader.readView(block.owner);
+    valid &= reader.readView(block.nonce);
+    valid &= reader.readView(block.data);
 
-    file.close();
-    return result;
+    valid &= reader.readView(block.signature.hash);
+    valid &= reader.readView(block.signature.signature);
+
+    return valid;
 }
 
-bool Blockchain::ImportBlockChain(const std::string& path) {
-    std::ifstream file(path, std::ios::in | std::ios::binary);
+static bool ReadBlockRecord(DataManipulator& reader, uint64_t version, BlockView& block, bool& intact, std::vector<std::string_view>& keys) {
+    intact = true;
+    if(version < FILE_VERSION_INLINE_KEYS) return ReadLegacyRecord(reader, block);
 
-    if(!file.is_open()) return false;
+    size_t start = reader.tell();
+    bool valid = true;
 
-    std::stringstream buf;
-    buf << file.rdbuf();
-    file.close();
-    if(!buf.good()) return false;
+    valid = valid && reader.readLE(block.id);
+    valid = valid && reader.readLE(block.previd);
+    valid = valid && reader.readLE(block.timestamp);
 
-    const std::string& data = buf.str();
+    valid = valid && reader.readView(block.prevhash, Sha256::Size);
 
-    DataManipulator reader(data.data(), data.size());
-    
-    FileHeader header;
-    reader.readData(header);
+    uint64_t keyRef = 0; // 0 defines the next key id inline, otherwise key id + 1
+    if(version >= FILE_VERSION_KEY_TABLE) valid = valid && reader.readVarint(keyRef);
+    if(keyRef == 0){
+        valid = valid && reader.readVarView(block.owner);
+    } else if(keyRef <= keys.size()){
+        block.owner = keys[keyRef - 1];
+    } else {
+        intact = false; // dangling reference, the record is unusable
+    }
+
+    valid = valid && reader.readVarView(block.nonce);
+    valid = valid && reader.readVarView(block.data);
+
+    valid = valid && reader.readView(block.signature.hash, Sha256::Size);
+    uint8_t algorithm = 0; // older files are RSA-PSS throughout
+    if(version >= FILE_VERSION) valid = valid && reader.readLE(algorithm);
+    block.signature.algorithm = SignatureAlgorithm(algorithm);
+    valid = valid && reader.readVarView(block.signature.signature);
+
+    size_t end = reader.tell();
+    uint32_t crc = 0;
+    valid = valid && reader.readLE(crc);
+
+    if(!valid) return false;
 
-    if(header.id != FILE_ID){
+    // a damaged definition still takes its id, so later references keep lining up
+    if(version >= FILE_VERSION_KEY_TABLE && keyRef == 0) keys.push_back(block.owner);
+    intact = intact && (crc32c(reader.at(start), end - start) == crc);
+    return true;
+}
+
+struct ChainHeader {
+    uint64_t version, blockCount;
+    size_t dataStart; // offset of the first block record
+};
+
+static bool ReadChainHeader(const MappedFile& file, ChainHeader& header, std::string& name) {
+    DataManipulator reader(file.data(), file.size());
+
+    uint32_t id = 0, version = 0;
+    reader.readLE(id);
+    reader.readLE(version);
+
+    if(id != FILE_ID){
         std::cout << "invalid file\n";
         return false; // invalid file header
     }
 
+    if(version < FILE_VERSION_INLINE_KEYS){ // legacy header, with a 64 bit size_t the version word is the high half of the id
+        DataManipulator legacy(file.data(), file.size());
+        FileHeader old {};
+        legacy.readData(old);
+        legacy.readString(name);
+
+        header.version = old.version;
+        header.blockCount = old.blockCount;
+        header.dataStart = legacy.tell();
+    } else {
+        header.version = version;
+        header.blockCount = 0;
+        reader.readLE(header.blockCount);
+        reader.readVarString(name);
+        header.dataStart = reader.tell();
+    }
+
     if(header.version > FILE_VERSION){
         std::cout << "file version unavailable\n";
         return false;
     }
 
+    return true;
+}
+
+bool Blockchain::ScanBlockChain(const std::string& path, ChainScan& scan) {
+    MappedFile file(path);
+    if(!file.IsOpen()) return false;
+
+    ChainHeader header;
+    std::string chainName;
+    if(!ReadChainHeader(file, header, chainName)) return false;
+
+    scan = { header.version, 0, 0, false };
+
+    DataManipulator reader(file.data() + header.dataStart, file.size() - header.dataStart);
+    std::vector<std::string_view> keys;
+    while(reader.remaining() > 0){
+        BlockView block {};
+        bool intact;
+
+        if(!ReadBlockRecord(reader, header.version, block, intact, keys)){
+            scan.truncated = true;
+            break;
+        }
+
+        ++scan.records;
+        if(!intact) ++scan.corrupt;
+    }
+
+    return true;
+}
+
+bool Blockchain::WriteStoredRecord(DataManipulator& writer, size_t pos, std::vector<uint32_t>& fileKeyIds, uint32_t& fileKeys) {
+    if(fileKeyIds.size() < chain.KeyCount()) fileKeyIds.resize(chain.KeyCount(), UINT32_MAX);
+
+    uint32_t& fileKey = fileKeyIds[chain.OwnerKey(pos)];
+    uint32_t keyRef = (fileKey == UINT32_MAX ? 0 : fileKey + 1);
+    if(!WriteBlockRecord(writer, chain[pos], keyRef)) return false;
+    if(keyRef == 0) fileKey = fileKeys++;
+    return true;
+}
+
+bool Blockchain::WriteBlockRecords(DataManipulator& writer, size_t from, std::vector<uint32_t>& fileKeyIds, uint32_t& fileKeys) {
+    for(size_t i = from; i < chain.size(); ++i){
+        if(!WriteStoredRecord(writer, i, fileKeyIds, fileKeys)) return false;
+    }
+
+    return true;
+}
+
+bool Blockchain::EncodeBlocks(DataManipulator& writer, const std::vector<BlockView>& blocks) {
+    writer.writeVarint(blocks.size());
+
+    std::unordered_map<std::string_view, uint32_t> keyIds; // owner -> key id in this encoding
+    for(const BlockView& block : blocks){
+        auto [it, added] = keyIds.emplace(block.owner, uint32_t(keyIds.size()));
+        if(!WriteBlockRecord(writer, block, added ? 0 : it->second + 1)) return false;
+    }
+
+    return true;
+}
+
+bool Blockchain::DecodeBlocks(DataManipulator& reader, std::vector<BlockView>& blocks) {
+    uint64_t count = 0;
+    if(!reader.readVarint(count)) return false;
+
+    std::vector<std::string_view> keys;
+    blocks.clear();
+    for(uint64_t i=0; i < count; ++i){
+        BlockView block {};
+        bool intact;
+        if(!ReadBlockRecord(reader, FILE_VERSION, block, intact, keys) || !intact) return false;
+        blocks.push_back(block);
+    }
+
+    return true;
+}
+
+bool Blockchain::WritePendingRecords(DataManipulator& writer, const std::vector<Block>& blocks, const std::vector<uint32_t>& fileKeyIds, uint32_t& fileKeys, std::unordered_map<std::string_view, uint32_t>& newKeys) {
+    for(const Block& block : blocks){
+        uint32_t keyId, keyRef = 0;
+        auto defined = newKeys.find(block.owner);
+        if(defined != newKeys.end()){
+            keyRef = defined->second + 1;
+        } else if(chain.FindKey(block.owner, keyId) && keyId < fileKeyIds.size() && fileKeyIds[keyId] != UINT32_MAX){
+            keyRef = fileKeyIds[keyId] + 1;
+        }
+
+        if(!WriteBlockRecord(writer, block.View(), keyRef)) return false;
+        if(keyRef == 0) newKeys.emplace(block.owner, fileKeys++);
+    }
+
+    return true;
+}
+
+bool Blockchain::CommitBlocks(std::vector<Block>& blocks, const std::string& path, bool rewrite) {
+    if(path.empty()){
+        for(Block& block : blocks) AppendBlock(std::move(block));
+        return true;
+    }
+
+    // no known on-disk state to extend, or a legacy file to upgrade
+    rewrite = rewrite || path != persistPath || persistedBlocks > chain.size() || persistedVersion != FILE_VERSION;
+    if(!rewrite && persistedBlocks == chain.size() && blocks.empty()) return true; // nothing new
+
+    size_t from = (rewrite ? 0 : persistedBlocks);
+    std::vector<uint32_t> fileKeyIds; // committed only once the records are on disk
+    uint32_t fileKeys = 0;
+    if(!rewrite){
+        fileKeyIds = persistedKeyIds;
+        fileKeys = persistedKeys;
+    }
+    uint64_t count = (rewrite ? 0 : persistedRecords) + (chain.size() - from) + blocks.size();
+
+    DataManipulator writer;
+    if(rewrite){
+        writer.writeLE(uint32_t(FILE_ID));
+        writer.writeLE(uint32_t(FILE_VERSION));
+        writer.writeLE(count);
+
+        writer.writeVarString(name);
+    }
+
+    std::unordered_map<std::string_view, uint32_t> newKeys; // owners of blocks not stored yet -> key id in the file
+    if(!WriteBlockRecords(writer, from, fileKeyIds, fileKeys)) return false;
+    if(!WritePendingRecords(writer, blocks, fileKeyIds, fileKeys, newKeys)) return false;
+
+    std::stringstream filebuffer;
+    if(!writer.exportData(filebuffer)) return false;
+
+    uint64_t size;
+    if(rewrite){
+        METRIC_TIMER(FileWrite);
+        std::ofstream file(path, std::ios::out | std::ios::binary);
+        if(!file.is_open()){
+            std::cout << "write file error\n";
+            return false;
+        }
+
+        bool result = (file << filebuffer.rdbuf()).good();
+        size = file.tellp();
+        METRIC_COUNT(FileBytesWritten, size);
+
+        file.close();
+        if(!result) return false;
+    } else {
+        const std::string& records = filebuffer.str();
+
+        FileWriter file(path);
+        if(!file.IsOpen()){
+            std::cout << "write file error\n";
+            return false;
+        }
+
+        // drop any torn record left by an interrupted append, then make the new records durable
+        if(!file.Truncate(persistedSize) || !file.WriteAt(persistedSize, records.data(), records.size()) || !file.Sync()){
+            std::cout << "append block error\n";
+            return false;
+        }
+
+        // the count is patched last; records past it are still recovered on import if this never lands
+        char countbytes[sizeof(count)];
+        for(size_t i=0; i < sizeof(count); ++i) countbytes[i] = char(count >> (8 * i));
+
+        if(!file.WriteAt(FILE_COUNT_OFFSET, countbytes, sizeof(countbytes)) || !file.Sync()){
+            std::cout << "append block error\n";
+            return false;
+        }
+        size = persistedSize + records.size();
+    }
+
+    // the new blocks are stored only once they are on disk, so a failed write leaves the chain as it was
+    for(const Block& block : blocks) AppendBlock(block.View(), CalculateBlockHash(block));
+    for(const auto& [owner, fileKey] : newKeys){
+        uint32_t keyId;
+        if(!chain.FindKey(owner, keyId)) continue;
+        if(keyId >= fileKeyIds.size()) fileKeyIds.resize(size_t(keyId) + 1, UINT32_MAX);
+        fileKeyIds[keyId] = fileKey;
+    }
+
+    persistPath = path;
+    persistedBlocks = chain.size();
+    persistedRecords = count;
+    persistedSize = size;
+    persistedVersion = FILE_VERSION;
+    persistedKeyIds = std::move(fileKeyIds);
+    persistedKeys = fileKeys;
+    if(rewrite) persistedClean = true;
+    return true;
+}
+
+bool Blockchain::ExportBlockChain(const std::string& path) {
+    std::vector<Block> none;
+    return CommitBlocks(none, path, true);
+}
+
+bool Blockchain::AppendBlockChain(const std::string& path) {
+    std::vector<Block> none;
+    return CommitBlocks(none, path);
+}
+
+bool Blockchain::ImportBlockChain(const std::string& path, unsigned threads) {
+    MappedFile file(path); // blocks are parsed as views into the mapping, only accepted blocks are copied out
+
+    if(!file.IsOpen()) return false;
+
+    ChainHeader header;
+    if(!ReadChainHeader(file, header, name)) return false;
+
     nextid = header.blockCount;
-    reader.readString(name);
     std::cout << "importing \"" << name << "\" blockchain\n";
+
+    DataManipulator reader(file.data() + header.dataStart, file.size() - header.dataStart);
+
+    std::vector<BlockView> blocks;
+    std::vector<uint64_t> recordEnds; // file offset past each intact record
+    blocks.reserve(std::min<size_t>(header.blockCount, file.size() / 64)); // a block is never smaller than its length fields
+    std::vector<std::string_view> fileKeys; // key table of the file, views into the mapping
+    size_t records = 0;
+    uint64_t end = reader.tell(); // end of the last complete record
+
+    // records appended after the last header update are recovered, a torn final record is dropped
+    for(size_t i=0; i < header.blockCount || reader.remaining() > 0; ++i){
+        BlockView block {};
+        bool intact;
+
+        if(!ReadBlockRecord(reader, header.version, block, intact, fileKeys)){
+            if(i < header.blockCount){
+                std::cout << "Failed to load block: End Of Stream\n";
+            } else {
+                std::cout << "Discarding truncated block record\n";
+            }
+            break;
+        }
+
+        ++records;
+        end = reader.tell();
+
+        if(!intact){ // corrupt on disk, rejected before any hashing or signature work
+            CountChecksumFailure();
+            std::cout << "Block record " << i << " failed its checksum\n";
+            continue;
+        }
+
+        if(block.id >= nextid && block.id != UINT32_MAX) nextid = block.id + 1;
+        blocks.push_back(block);
+        recordEnds.push_back(header.dataStart + end);
+    }
+
+    persistPath = path;
+    persistedRecords = records;
+    persistedSize = header.dataStart + end;
+    persistedVersion = header.version;
+
+    // blocks covered by a trusted checkpoint are hash checked only, their signatures were verified before
+    size_t trusted = (checkpointPath.empty() ? 0 : LoadCheckpoint(file, blocks, recordEnds));
+    if(trusted) std::cout << "checkpoint covers " << trusted << " blocks, verifying signatures after it\n";
+
     size_t sc = 0;
-    for(size_t i=0; i < header.blockCount; ++i){
-        Block block {};
-        bool valid = true;
+    if(threads > 1){
+        sc = ValidateParallel(blocks, threads, trusted);
+    } else {
+        for(size_t i=0; i < blocks.size(); ++i){
+            const BlockView& view = blocks[i];
+            std::cout << "Importing block [" << view.id << "] ...";
+
+            Digest sigHash;
+            HashBlockFields(view, false, sigHash);
+            
+            BlockError error = CheckBlock(view, sigHash.view(), i >= trusted);
+            if(!ReportBlockError(error)){
+                CountRejection(error);
+                std::cout << " failed!                                            \n";
+                continue;
+            }
+
+            Digest hash;
+            HashBlockFields(view, true, hash);
+            AppendBlock(view, hash.view());
+            std::cout << " success                                    \r";
+            ++sc;
+        }
+    }
 
-        valid &= reader.readData(block.id);
-        valid &= reader.readData(block.previd);
-        valid &= reader.readData(block.timestamp);
+    persistedBlocks = chain.size();
+    persistedClean = (sc == records);
 
-        valid &= reader.readString(block.prevhash);
-        valid &= reader.readString(block.owner);
-        valid &= reader.readString(block.nonce);
-        valid &= reader.readString(block.data);
+    TrackPersistedKeys(fileKeys);
 
-        valid &= reader.readString(block.signature.hash);
-        valid &= reader.readString(block.signature.signature);
+    std::cout << "\n" << sc << " blocks imported successfully!\n";
 
-        if(!valid){
-            std::cout << "Failed to load block: End Of Stream\n";
-            break;
+    return true;
+}
+
+void Blockchain::TrackPersistedKeys(const std::vector<std::string_view>& fileKeys) {
+    // appends reference keys the file already defines instead of writing them again
+    persistedKeyIds.assign(chain.KeyCount(), UINT32_MAX);
+    persistedKeys = fileKeys.size();
+    for(uint32_t f=0; f < fileKeys.size(); ++f){
+        uint32_t keyId;
+        if(chain.FindKey(fileKeys[f], keyId) && persistedKeyIds[keyId] == UINT32_MAX) persistedKeyIds[keyId] = f;
+    }
+}
+
+size_t Blockchain::ValidateParallel(const std::vector<BlockView>& blocks, unsigned threads, size_t trusted) {
+    // each block is checked against the stored block carrying its previd, or else the first earlier block
+    // of the list carrying it, which is the parent the sequential import would find if that block is accepted
+    std::vector<size_t> parent(blocks.size(), SIZE_MAX), stored(blocks.size(), SIZE_MAX);
+    {
+        std::unordered_map<uint32_t, size_t> first;
+        for(size_t i=0; i < blocks.size(); ++i){
+            if(blocks[i].id != 0){
+                stored[i] = FindPosition(blocks[i].previd);
+                auto it = first.find(blocks[i].previd);
+                if(stored[i] == SIZE_MAX && it != first.end()) parent[i] = it->second;
+            }
+            first.emplace(blocks[i].id, i);
+        }
+    }
+
+    std::vector<Digest> hashes(blocks.size()), sigHashes(blocks.size());
+    std::vector<BlockError> result(blocks.size(), BlockError::None);
+    std::atomic<size_t> next(0);
+
+    auto run = [&](auto task) {
+        std::vector<std::thread> pool;
+        next = 0;
+        for(unsigned t=0; t < threads; ++t) pool.emplace_back([&]() {
+            for(size_t i = next++; i < blocks.size(); i = next++) task(i);
+        });
+        for(std::thread& th : pool) th.join();
+    };
+
+    std::cout << "Validating " << blocks.size() << " blocks on " << threads << " threads...\n";
+
+    // hash every block first so the checks below only read shared parents
+    run([&](size_t i) {
+        HashBlockFields(blocks[i], true, hashes[i]);
+        HashBlockFields(blocks[i], false, sigHashes[i]);
+    });
+
+    // structure first, the signatures of the blocks that pass then go through one batch
+    std::vector<BlockView> storedViews(blocks.size()); // stored parents, nothing is appended until the resolution below
+    for(size_t i=0; i < blocks.size(); ++i){
+        if(stored[i] != SIZE_MAX) storedViews[i] = chain[stored[i]];
+    }
+
+    run([&](size_t i) {
+        size_t p = parent[i];
+        if(stored[i] != SIZE_MAX){
+            result[i] = CheckBlock(blocks[i], sigHashes[i].view(), &storedViews[i], chain.Hash(stored[i]), false);
+        } else {
+            result[i] = (p == SIZE_MAX ? CheckBlock(blocks[i], sigHashes[i].view(), nullptr, std::string_view(), false)
+                                       : CheckBlock(blocks[i], sigHashes[i].view(), &blocks[p], hashes[p].view(), false));
         }
+    });
+
+    std::vector<VerifyRequest> requests;
+    std::vector<size_t> requested; // request -> block
+    for(size_t i = trusted; i < blocks.size(); ++i){
+        if(result[i] != BlockError::None) continue;
 
-        std::cout << "Importing block [" << block.id << "] ...";
-        
-        if(!ValidateBlockSignature(block)){
-            std::cout << " failed!                                            \n";
+        const BlockView& signer = (blocks[i].id == 0 ? blocks[i] : stored[i] != SIZE_MAX ? storedViews[i] : blocks[parent[i]]);
+        requests.push_back({ signer.owner, blocks[i].signature.algorithm, blocks[i].signature.hash, blocks[i].signature.signature });
+        requested.push_back(i);
+    }
+
+    std::vector<bool> verified = Crypto::VerifyBatch(requests, threads, &keys);
+    for(size_t r=0; r < requested.size(); ++r){
+        if(!verified[r]) result[requested[r]] = BlockError::BadSignature;
+    }
+
+    // resolve in file order so acceptance matches the sequential path exactly
+    std::unordered_map<uint32_t, size_t> accepted; // id -> first accepted block
+    size_t sc = 0;
+    for(size_t i=0; i < blocks.size(); ++i){
+        const BlockView& view = blocks[i];
+        BlockError error = result[i];
+
+        if(view.id != 0 && stored[i] == SIZE_MAX){ // a stored parent can't change
+            auto it = accepted.find(view.previd);
+            size_t actual = (it == accepted.end() ? SIZE_MAX : it->second);
+
+            if(actual != parent[i]){ // candidate parent was rejected, recheck against the real one
+                error = (actual == SIZE_MAX ? CheckBlock(view, sigHashes[i].view(), nullptr, std::string_view(), i >= trusted)
+                                            : CheckBlock(view, sigHashes[i].view(), &blocks[actual], hashes[actual].view(), i >= trusted));
+            }
+        }
+
+        if(error != BlockError::None){
+            CountRejection(error);
+            std::cout << "Importing block [" << view.id << "] ... failed!\n";
             continue;
         }
 
-        chain.emplace_back(std::move(block));
-        std::cout << " success                                    \r";
+        accepted.emplace(view.id, i);
+
+        AppendBlock(view, hashes[i].view());
         ++sc;
     }
 
-    std::cout << "\n" << sc << " blocks imported successfully!\n";
+    return sc;
+}
+
+
+struct Checkpoint {
+    uint64_t records; // leading file records covered
+    uint32_t lastId; // last covered block
+    std::string lastHash, fileHash; // hash of that block / of the file from the name up to the end of that block
+};
+
+static std::string CheckpointBody(const Checkpoint& checkpoint, std::string_view publicKey) {
+    DataManipulator writer;
+    writer.writeLE(uint32_t(FILE_ID));
+    writer.writeLE(uint32_t(CHECKPOINT_VERSION));
+    writer.writeLE(checkpoint.records);
+    writer.writeLE(checkpoint.lastId);
+    writer.writeBytes(checkpoint.lastHash.data(), checkpoint.lastHash.size());
+    writer.writeBytes(checkpoint.fileHash.data(), checkpoint.fileHash.size());
+    writer.writeVarString(publicKey);
+
+    std::stringstream body;
+    writer.exportData(body);
+    return body.str();
+}
+
+static std::string HashChainPrefix(const MappedFile& file, uint64_t end) {
+    // the block count in the header changes on every append, so the hash starts at the chain name
+    const uint64_t start = FILE_COUNT_OFFSET + sizeof(uint64_t);
+    if(end < start || end > file.size()) return "";
+
+    return Crypto::sha256_hash(std::string_view(file.data() + start, end - start));
+}
+
+bool Blockchain::SigningKey(CryptoKey& key, std::string& publicKey) {
+    LoadSigner();
+    if(!signer.IsValid()) return false;
+
+    key = signer.Key();
+    publicKey = signerPublic;
+    return !publicKey.empty();
+}
+
+bool Blockchain::ReadCheckpoint(Checkpoint& checkpoint) {
+    MappedFile source(checkpointPath);
+    if(!source.IsOpen()) return false;
+
+    DataManipulator reader(source.data(), source.size());
+    uint32_t id = 0, version = 0;
+    std::string_view lastHash, fileHash, publicKey, signature;
+
+    bool valid = reader.readLE(id) && reader.readLE(version) && id == FILE_ID && version == CHECKPOINT_VERSION;
+    valid = valid && reader.readLE(checkpoint.records) && reader.readLE(checkpoint.lastId);
+    valid = valid && reader.readView(lastHash, Sha256::Size) && reader.readView(fileHash, Sha256::Size);
+    valid = valid && reader.readVarView(publicKey);
+    size_t bodyEnd = reader.tell();
+    valid = valid && reader.readVarView(signature);
+    if(!valid){
+        std::cout << "checkpoint is unreadable, verifying every block\n";
+        return false;
+    }
+
+    // only a checkpoint signed by the current user is trusted
+    CryptoKey key;
+    std::string myKey;
+    if(!SigningKey(key, myKey) || publicKey != myKey){
+        std::cout << "checkpoint isn't signed by the current key, verifying every block\n";
+        return false;
+    }
+
+    if(!key.VerifyHash(signature, Crypto::sha256_hash(std::string_view(source.data(), bodyEnd)))){
+        std::cout << "checkpoint signature is invalid, verifying every block\n";
+        return false;
+    }
+
+    checkpoint.lastHash = lastHash;
+    checkpoint.fileHash = fileHash;
+    return true;
+}
+
+static bool MatchCheckpoint(const Checkpoint& checkpoint, const MappedFile& file, const BlockView& last, uint64_t lastEnd) {
+    // the covered records must be byte for byte the ones that were verified
+    Digest hash;
+    HashBlockFields(last, true, hash);
+    if(last.id != checkpoint.lastId || hash.view() != checkpoint.lastHash || HashChainPrefix(file, lastEnd) != checkpoint.fileHash){
+        std::cout << "checkpoint doesn't match the chain, verifying every block\n";
+        return false;
+    }
 
     return true;
-}
\ No newline at end of file
+}
+
+size_t Blockchain::LoadCheckpoint(const MappedFile& file, const std::vector<BlockView>& blocks, const std::vector<uint64_t>& recordEnds) {
+    Checkpoint checkpoint {};
+    if(persistedVersion != FILE_VERSION || !ReadCheckpoint(checkpoint)) return 0;
+
+    size_t covered = checkpoint.records;
+    if(covered == 0 || covered > blocks.size()){
+        std::cout << "checkpoint doesn't match the chain, verifying every block\n";
+        return 0;
+    }
+
+    if(!MatchCheckpoint(checkpoint, file, blocks[covered - 1], recordEnds[covered - 1])) return 0;
+
+    checkpointRecords = covered;
+    return covered;
+}
+
+bool Blockchain::WriteCheckpoint(const std::string& path) {
+    if(persistPath.empty() || persistedVersion != FILE_VERSION || !persistedClean || persistedRecords == 0){
+        return false; // only a fully accepted chain file in the current format can be checkpointed
+    }
+
+    if(checkpointRecords == persistedRecords) return true; // already covered
+
+    CryptoKey key;
+    std::string publicKey;
+    if(!SigningKey(key, publicKey)) return false;
+
+    MappedFile file(persistPath);
+    if(!file.IsOpen() || file.size() < persistedSize) return false;
+
+    Checkpoint checkpoint;
+    checkpoint.records = persistedRecords;
+    checkpoint.lastId = chain.back().id; // a clean file holds exactly the chain, in order
+    checkpoint.lastHash = chain.Hash(chain.size() - 1);
+    checkpoint.fileHash = HashChainPrefix(file, persistedSize);
+    if(checkpoint.fileHash.empty()) return false;
+
+    std::string body = CheckpointBody(checkpoint, publicKey);
+    std::string signature = key.SignHash(Crypto::sha256_hash(body));
+    if(signature.empty()) return false;
+
+    DataManipulator writer;
+    writer.writeBytes(body.data(), body.size());
+    writer.writeVarString(signature);
+
+    std::stringstream filebuffer;
+    if(!writer.exportData(filebuffer)) return false;
+
+    METRIC_TIMER(FileWrite);
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    if(!out.is_open()){
+        std::cout << "write file error\n";
+        return false;
+    }
+
+    bool result = (out << filebuffer.rdbuf()).good();
+    METRIC_COUNT(FileBytesWritten, uint64_t(out.tellp()));
+    out.close();
+
+    if(result) checkpointRecords = persistedRecords;
+    return result;
+}
+
+struct ImportItem {
+    size_t index; // among the intact records
+    BlockView view;
+    size_t parent; // index of the first earlier block with the previd, SIZE_MAX for none
+    std::string_view parentOwner; // key the block must be signed with
+    bool trusted; // covered by a matching checkpoint
+    Digest sigHash, hash;
+    bool signatureOk;
+};
+
+typedef std::vector<ImportItem> ImportBatch;
+
+std::shared_future<bool> Blockchain::ImportBlockChainAsync(const std::string& path, unsigned threads, ImportCallback progress) {
+    if(pendingImport.valid()) pendingImport.wait(); // one import at a time
+
+    pendingImport = std::async(std::launch::async, [this, path, threads, progress] {
+        return ImportPipeline(path, threads, progress);
+    }).share();
+    return pendingImport;
+}
+
+bool Blockchain::ImportPipeline(const std::string& path, unsigned threads, const ImportCallback& progress) {
+    MappedFile file(path); // every stage works on views into the mapping, the store copies accepted blocks out
+
+    if(!file.IsOpen()) return false;
+
+    ChainHeader header;
+    if(!ReadChainHeader(file, header, name)) return false;
+
+    std::cout << "importing \"" << name << "\" blockchain\n";
+
+    const size_t batchSize = 64;
+    const unsigned hashers = std::max(1u, threads / 4), verifiers = std::max(1u, threads);
+    BlockingQueue<ImportBatch> parsed, hashed, verified;
+    std::atomic<size_t> parsedCount(0);
+    std::atomic<unsigned> hashersLeft(hashers), verifiersLeft(verifiers);
+
+    // parse stage, written by the parser and read once it has been joined
+    std::vector<std::string_view> fileKeys;
+    size_t records = 0;
+    uint64_t end = 0, maxId = header.blockCount;
+
+    Checkpoint checkpoint {};
+    size_t covered = 0; // blocks held back until the checkpoint's last block shows whether to trust them
+    if(!checkpointPath.empty() && header.version == FILE_VERSION && ReadCheckpoint(checkpoint)) covered = checkpoint.records;
+
+    std::thread parser([&] {
+        DataManipulator reader(file.data() + header.dataStart, file.size() - header.dataStart);
+        std::unordered_map<uint32_t, size_t> first; // id -> index of its first block
+        std::vector<std::string_view> owners; // index -> owner, for the candidate parent lookups
+        ImportBatch batch, held;
+        end = reader.tell();
+
+        auto emit = [&](ImportBatch& items) {
+            parsedCount += items.size();
+            parsed.push(std::move(items));
+            items = ImportBatch();
+        };
+
+        auto release = [&](bool trusted) { // hand the held prefix on in batches
+            for(size_t i=0; i < held.size(); i += batchSize){
+                ImportBatch part;
+                for(size_t j = i; j < std::min(held.size(), i + batchSize); ++j){
+                    held[j].trusted = trusted;
+                    part.push_back(held[j]);
+                }
+                emit(part);
+            }
+            held.clear();
+            covered = 0;
+        };
+
+        for(size_t i=0; i < header.blockCount || reader.remaining() > 0; ++i){
+            ImportItem item {};
+            bool intact;
+
+            if(!ReadBlockRecord(reader, header.version, item.view, intact, fileKeys)){
+                if(i < header.blockCount){
+                    std::cout << "Failed to load block: End Of Stream\n";
+                } else {
+                    std::cout << "Discarding truncated block record\n";
+                }
+                break;
+            }
+
+            ++records;
+            end = reader.tell();
+
+            if(!intact){ // corrupt on disk, rejected before any hashing or signature work
+                CountChecksumFailure();
+                std::cout << "Block record " << i << " failed its checksum\n";
+                continue;
+            }
+
+            const BlockView& view = item.view;
+            if(view.id >= maxId && view.id != UINT32_MAX) maxId = view.id + 1;
+
+            item.index = owners.size();
+            item.parent = SIZE_MAX;
+            item.parentOwner = view.owner; // the root signs itself
+            if(view.id != 0){
+                auto it = first.find(view.previd);
+                if(it != first.end()){
+                    item.parent = it->second;
+                    item.parentOwner = owners[it->second];
+                }
+            }
+            first.emplace(view.id, item.index);
+            owners.push_back(view.owner);
+
+            if(item.index < covered){
+                held.push_back(item);
+                if(item.index + 1 == covered){
+                    bool match = MatchCheckpoint(checkpoint, file, view, header.dataStart + end);
+                    if(match){
+                        checkpointRecords = covered;
+                        std::cout << "checkpoint covers " << covered << " blocks, verifying signatures after it\n";
+                    }
+                    release(match);
+                }
+                continue;
+            }
+
+            batch.push_back(item);
+            if(batch.size() == batchSize) emit(batch);
+        }
+
+        if(!held.empty()){
+            std::cout << "checkpoint doesn't match the chain, verifying every block\n";
+            release(false);
+        }
+        if(!batch.empty()) emit(batch);
+        parsed.close();
+    });
+
+    std::vector<std::thread> workers;
+    for(unsigned t=0; t < hashers; ++t){
+        workers.emplace_back([&] {
+            ImportBatch batch;
+            while(parsed.pop(batch)){
+                for(ImportItem& item : batch){
+                    HashBlockFields(item.view, false, item.sigHash);
+                    HashBlockFields(item.view, true, item.hash);
+                }
+                hashed.push(std::move(batch));
+            }
+            if(--hashersLeft == 0) hashed.close();
+        });
+    }
+
+    for(unsigned t=0; t < verifiers; ++t){
+        workers.emplace_back([&] {
+            ImportBatch batch;
+            std::vector<VerifyRequest> requests;
+            std::vector<ImportItem*> requested;
+            while(hashed.pop(batch)){
+                requests.clear();
+                requested.clear();
+                for(ImportItem& item : batch){
+                    item.signatureOk = true; // nothing to verify, or rejected on the hash when resolved
+                    if(item.trusted || item.view.signature.hash != item.sigHash.view()) continue;
+
+                    requests.push_back({ item.parentOwner, item.view.signature.algorithm, item.view.signature.hash, item.view.signature.signature });
+                    requested.push_back(&item);
+                }
+
+                std::vector<bool> ok = Crypto::VerifyBatch(requests, 1, &keys); // the verifiers already run side by side
+                for(size_t r=0; r < requested.size(); ++r) requested[r]->signatureOk = ok[r];
+                verified.push(std::move(batch));
+            }
+            if(--verifiersLeft == 0) verified.close();
+        });
+    }
+
+    // resolve stage, on this thread: blocks are stored in file order so acceptance matches the synchronous import
+    std::map<size_t, ImportItem> waiting;
+    std::unordered_map<uint32_t, size_t> accepted; // id -> index of the first accepted block
+    ImportProgress status { 0, 0, 0, false };
+    size_t next = 0;
+
+    ImportBatch batch;
+    while(verified.pop(batch)){
+        for(ImportItem& item : batch) waiting.emplace(item.index, std::move(item));
+
+        for(auto it = waiting.begin(); it != waiting.end() && it->first == next; it = waiting.erase(it), ++next){
+            const ImportItem& item = it->second;
+            const BlockView& view = item.view;
+
+            bool sameParent = (view.id == 0);
+            if(!sameParent){
+                auto parent = accepted.find(view.previd);
+                sameParent = (parent != accepted.end() && parent->second == item.parent);
+            }
+
+            BlockError error;
+            if(sameParent){ // the signature was checked against the parent actually stored
+                error = CheckBlock(view, item.sigHash.view(), false);
+                if(error == BlockError::None && !item.signatureOk) error = BlockError::BadSignature;
+            } else { // the candidate parent was rejected, recheck against the real one
+                error = CheckBlock(view, item.sigHash.view(), !item.trusted);
+            }
+
+            if(error != BlockError::None){
+                CountRejection(error);
+                std::cout << "Importing block [" << view.id << "] ... failed!\n";
+                ++status.rejected;
+                continue;
+            }
+
+            accepted.emplace(view.id, item.index);
+            AppendBlock(view, item.hash.view());
+            ++status.accepted;
+        }
+
+        status.parsed = parsedCount;
+        if(progress) progress(status);
+    }
+
+    parser.join();
+    for(std::thread& worker : workers) worker.join();
+
+    nextid = maxId;
+    persistPath = path;
+    persistedRecords = records;
+    persistedSize = header.dataStart + end;
+    persistedVersion = header.version;
+    persistedBlocks = chain.size();
+    persistedClean = (status.accepted == records);
+    TrackPersistedKeys(fileKeys);
+
+    status.parsed = parsedCount;
+    status.done = true;
+    if(progress) progress(status);
+
+    std::cout << status.accepted << " blocks imported successfully!\n";
+    return true;
+}
+
+
+enum class SyncStatus : uint8_t { Ok, BadRequest, OtherChain };
+
+static const size_t SyncBatchBlocks = 512, SyncBatchBytes = size_t(4) << 20; // per Blocks frame
+static const size_t SyncHelloLeaves = 16384; // newest leaves sent, keeps the hello well below its frame limit
+
+std::vector<size_t> Blockchain::Locator() const {
+    std::vector<size_t> found;
+    size_t pos = canonicalTip, step = 1;
+    while(pos != SIZE_MAX){
+        found.push_back(pos);
+        if(found.size() >= 10) step *= 2;
+
+        for(size_t s=0; s < step && chain.Id(pos) != 0; ++s) pos = FindPosition(chain.PrevId(pos));
+        if(pos == found.back()) break; // the root
+    }
+    return found;
+}
+
+bool Blockchain::ServeSync(Transport& peer) {
+    std::string hello;
+    if(!peer.ReceiveFrame(hello, size_t(1) << 20)) return false;
+    return ServeSync(peer, hello);
+}
+
+bool Blockchain::ServeSync(Transport& peer, std::string_view hello) {
+    DataManipulator reader(hello.data(), hello.size());
+    uint8_t type = 0;
+    uint32_t version = 0;
+    uint64_t count = 0;
+    std::string_view root;
+    bool valid = reader.readLE(type) && type == uint8_t(SyncMessage::Hello) && reader.readLE(version) && version == SYNC_VERSION;
+    valid = valid && reader.readView(root, Sha256::Size) && reader.readVarint(count) && count <= reader.remaining() / (sizeof(uint32_t) + Sha256::Size);
+
+    std::vector<std::pair<uint32_t, std::string_view>> locator, peerLeaves;
+    for(uint64_t i=0; valid && i < count; ++i){
+        uint32_t id = 0;
+        std::string_view hash;
+        valid = reader.readLE(id) && reader.readView(hash, Sha256::Size);
+        locator.emplace_back(id, hash);
+    }
+
+    valid = valid && reader.readVarint(count) && count <= reader.remaining() / (sizeof(uint32_t) + Sha256::Size);
+    for(uint64_t i=0; valid && i < count; ++i){
+        uint32_t id = 0;
+        std::string_view hash;
+        valid = reader.readLE(id) && reader.readView(hash, Sha256::Size);
+        peerLeaves.emplace_back(id, hash);
+    }
+
+    SyncStatus status = (valid ? SyncStatus::Ok : SyncStatus::BadRequest);
+    std::vector<size_t> missing;
+    DataManipulator reply;
+    {
+        std::shared_lock<std::shared_mutex> guard(chainLock);
+
+        size_t rootPos = FindPosition(0);
+        Digest none {};
+        if(status == SyncStatus::Ok && rootPos != SIZE_MAX && root != none.view() && root != chain.Hash(rootPos)) status = SyncStatus::OtherChain;
+
+        size_t ancestor = SIZE_MAX; // the first locator block held here with the same hash
+        for(const auto& [id, hash] : locator){
+            size_t pos = FindPosition(id);
+            if(pos != SIZE_MAX && chain.Hash(pos) == hash){
+                ancestor = pos;
+                break;
+            }
+        }
+
+        if(status == SyncStatus::Ok){ // the peer has the ancestor, its leaves held here too, and everything they stem from
+            std::vector<bool> known(chain.size(), false);
+            auto held = [&](size_t pos) { // walks down until a branch marked before
+                for(; pos != SIZE_MAX && !known[pos]; pos = (chain.Id(pos) == 0 ? SIZE_MAX : FindPosition(chain.PrevId(pos)))) known[pos] = true;
+            };
+
+            held(ancestor);
+            for(const auto& [id, hash] : peerLeaves){
+                size_t pos = FindPosition(id);
+                if(pos != SIZE_MAX && chain.Hash(pos) == hash) held(pos);
+            }
+
+            for(size_t pos=0; pos < chain.size(); ++pos){
+                if(!known[pos]) missing.push_back(pos);
+            }
+        }
+
+        reply.writeLE(uint8_t(SyncMessage::Reply));
+        reply.writeLE(uint8_t(status));
+        reply.writeVarString(name);
+        reply.writeLE(canonicalTip == SIZE_MAX ? UINT32_MAX : chain.Id(canonicalTip));
+        reply.writeBytes(canonicalTip == SIZE_MAX ? none.view().data() : chain.Hash(canonicalTip).data(), Sha256::Size);
+        reply.writeLE(canonicalTip == SIZE_MAX ? uint64_t(0) : weights[canonicalTip].work);
+        reply.writeLE(ancestor == SIZE_MAX ? UINT32_MAX : chain.Id(ancestor));
+        reply.writeLE(uint64_t(missing.size()));
+    }
+
+    if(!peer.SendFrame(reply.str())) return false;
+    if(status != SyncStatus::Ok) return true;
+
+    // the key table runs across frames, as it does across a chain file
+    std::vector<uint32_t> streamKeyIds;
+    uint32_t streamKeys = 0;
+    for(size_t i=0; i < missing.size();){
+        DataManipulator records;
+        size_t count = 0, bytes = 0;
+        {
+            std::shared_lock<std::shared_mutex> guard(chainLock); // released while the frame goes out
+            for(; i < missing.size() && count < SyncBatchBlocks && bytes < SyncBatchBytes; ++i, ++count){
+                BlockView view = chain[missing[i]];
+                bytes += view.owner.size() + view.nonce.size() + view.data.size() + view.signature.signature.size();
+                if(!WriteStoredRecord(records, missing[i], streamKeyIds, streamKeys)) return false;
+            }
+        }
+
+        DataManipulator frame;
+        frame.writeLE(uint8_t(SyncMessage::Blocks));
+        frame.writeVarint(count);
+        std::string body = records.str();
+        frame.writeBytes(body.data(), body.size());
+        if(!peer.SendFrame(frame.str())) return false;
+    }
+
+    DataManipulator end;
+    end.writeLE(uint8_t(SyncMessage::End));
+    return peer.SendFrame(end.str());
+}
+
+bool Blockchain::SyncFrom(Transport& peer, unsigned threads) {
+    DataManipulator hello;
+    hello.writeLE(uint8_t(SyncMessage::Hello));
+    hello.writeLE(uint32_t(SYNC_VERSION));
+    {
+        std::shared_lock<std::shared_mutex> guard(chainLock);
+
+        size_t rootPos = FindPosition(0);
+        Digest none {};
+        hello.writeBytes(rootPos == SIZE_MAX ? none.view().data() : chain.Hash(rootPos).data(), Sha256::Size); // none asks for everything
+
+        std::vector<size_t> locator = Locator();
+        hello.writeVarint(locator.size());
+        for(size_t pos : locator){
+            hello.writeLE(chain.Id(pos));
+            hello.writeBytes(chain.Hash(pos).data(), Sha256::Size);
+        }
+
+        // side branches the canonical sample misses; past the limit the oldest are left out and merely sent again
+        std::vector<size_t> tips(leaves);
+        if(tips.size() > SyncHelloLeaves){
+            std::nth_element(tips.begin(), tips.begin() + SyncHelloLeaves, tips.end(), std::greater<size_t>());
+            tips.resize(SyncHelloLeaves);
+        }
+        hello.writeVarint(tips.size());
+        for(size_t pos : tips){
+            hello.writeLE(chain.Id(pos));
+            hello.writeBytes(chain.Hash(pos).data(), Sha256::Size);
+        }
+    }
+
+    std::string replyFrame;
+    if(!peer.SendFrame(hello.str()) || !peer.ReceiveFrame(replyFrame)){
+        std::cout << "sync: the peer closed the connection\n";
+        return false;
+    }
+
+    DataManipulator reader(replyFrame.data(), replyFrame.size());
+    uint8_t type = 0, status = 0;
+    std::string peerName;
+    uint32_t tipId = 0, ancestorId = 0;
+    std::string_view tipHash;
+    uint64_t tipWork = 0, count = 0;
+    bool valid = reader.readLE(type) && type == uint8_t(SyncMessage::Reply) && reader.readLE(status);
+    valid = valid && reader.readVarString(peerName) && reader.readLE(tipId) && reader.readView(tipHash, Sha256::Size);
+    valid = valid && reader.readLE(tipWork) && reader.readLE(ancestorId) && reader.readLE(count);
+    if(!valid || status == uint8_t(SyncStatus::BadRequest)){
+        std::cout << "sync: malformed exchange with the peer\n";
+        return false;
+    }
+    if(status == uint8_t(SyncStatus::OtherChain)){
+        std::cout << "sync: the peer holds a different chain\n";
+        return false;
+    }
+
+    if(chain.empty()) name = peerName; // a fresh node takes the peer's chain
+    std::cout << "peer tip [" << tipId << "] work " << tipWork << ", common ancestor "
+              << (ancestorId == UINT32_MAX ? std::string("none") : "[" + std::to_string(ancestorId) + "]")
+              << ", " << count << " blocks to receive\n";
+
+    std::string frame; // one at a time, accepted blocks are copied into the store
+    std::deque<std::string> ownedKeys; // keys outlive the frame defining them, later frames refer to them; never moved
+    std::vector<std::string_view> streamKeys;
+    size_t received = 0, known = 0, conflicts = 0, accepted = 0, rejected = 0;
+
+    for(;;){
+        if(!peer.ReceiveFrame(frame)){
+            std::cout << "sync: the connection was lost after " << received << " blocks\n";
+            return false;
+        }
+
+        DataManipulator records(frame.data(), frame.size());
+        uint64_t batch = 0;
+        if(!records.readLE(type) || (type != uint8_t(SyncMessage::End) && (type != uint8_t(SyncMessage::Blocks) || !records.readVarint(batch)))){
+            std::cout << "sync: malformed frame from the peer\n";
+            return false;
+        }
+        if(type == uint8_t(SyncMessage::End)) break;
+
+        size_t keysBefore = streamKeys.size();
+        std::vector<BlockView> blocks;
+        for(uint64_t i=0; i < batch; ++i){
+            BlockView view {};
+            bool intact;
+            if(!ReadBlockRecord(records, FILE_VERSION, view, intact, streamKeys)){
+                std::cout << "sync: malformed block record from the peer\n";
+                return false;
+            }
+
+            ++received;
+            if(!intact){
+                CountChecksumFailure();
+                ++rejected;
+                continue;
+            }
+
+            size_t pos = FindPosition(view.id); // a tree shaped chain can send blocks that are already here
+            if(pos != SIZE_MAX){
+                Digest hash;
+                HashBlockFields(view, true, hash);
+                if(hash.view() == chain.Hash(pos)){
+                    ++known;
+                } else {
+                    std::cout << "Block [" << view.id << "] from the peer conflicts with the stored one, keeping ours\n";
+                    ++conflicts;
+                }
+                continue;
+            }
+
+            if(view.id >= nextid && view.id != UINT32_MAX) nextid = view.id + 1;
+            blocks.push_back(view);
+        }
+
+        size_t stored = ValidateParallel(blocks, threads, 0);
+        accepted += stored;
+        rejected += blocks.size() - stored;
+
+        for(size_t k = keysBefore; k < streamKeys.size(); ++k){ // before the frame is overwritten
+            ownedKeys.emplace_back(streamKeys[k]);
+            streamKeys[k] = ownedKeys.back();
+        }
+    }
+
+    std::cout << "synced " << received << " blocks: " << accepted << " new, " << known << " already held, " << conflicts << " conflicting, " << rejected << " rejected\n";
+    return true;
+}
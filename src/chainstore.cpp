@@ -0,0 +1,151 @@
+#include "chainstore.h"
+
+#include <cstring>
+
+Arena::Arena(): used(0), available(0), reserved(0) {}
+
+std::string_view Arena::Store(std::string_view bytes) {
+    if(bytes.empty()) return std::string_view();
+
+    if(bytes.size() > ChunkSize / 4){ // large payloads get their own chunk so the current one keeps filling
+        std::unique_ptr<char[]> chunk(new char[bytes.size()]);
+        char* out = chunk.get();
+        chunks.emplace(chunks.end() - (chunks.empty() ? 0 : 1), std::move(chunk));
+        memcpy(out, bytes.data(), bytes.size());
+        reserved += bytes.size();
+        return std::string_view(out, bytes.size());
+    }
+
+    if(bytes.size() > available){
+        chunks.emplace_back(new char[ChunkSize]);
+        used = 0;
+        available = ChunkSize;
+        reserved += ChunkSize;
+    }
+
+    char* out = chunks.back().get() + used;
+    memcpy(out, bytes.data(), bytes.size());
+    used += bytes.size();
+    available -= bytes.size();
+    return std::string_view(out, bytes.size());
+}
+
+void Arena::Clear() {
+    chunks.clear();
+    used = available = reserved = 0;
+}
+
+uint32_t ChainStore::InternKey(std::string_view key) {
+    auto it = keyIds.find(key);
+    if(it != keyIds.end()) return it->second;
+
+    uint32_t keyId = keyTable.size();
+    std::string_view stored = arena.Store(key);
+    keyTable.push_back(stored);
+    keyIds.emplace(stored, keyId);
+    return keyId;
+}
+
+bool ChainStore::FindKey(std::string_view key, uint32_t& keyId) const {
+    auto it = keyIds.find(key);
+    if(it == keyIds.end()) return false;
+
+    keyId = it->second;
+    return true;
+}
+
+BlockView ChainStore::operator[](size_t pos) const {
+    BlockView block;
+    block.prevhash = prevhashes[pos].view();
+    block.id = ids[pos];
+    block.previd = previds[pos];
+    block.timestamp = timestamps[pos];
+    block.nonce = nonces[pos];
+    block.owner = keyTable[owners[pos]];
+    block.data = datas[pos];
+    block.signature.hash = signatureHashes[pos].view();
+    block.signature.signature = signatures[pos];
+    block.signature.algorithm = algorithms[pos];
+    return block;
+}
+
+bool ChainStore::push_back(const BlockView& block, std::string_view hash) {
+    if(block.prevhash.size() != Sha256::Size || block.signature.hash.size() != Sha256::Size || hash.size() != Sha256::Size){
+        return false;
+    }
+
+    Digest digest;
+    memcpy(digest.bytes, block.prevhash.data(), Sha256::Size);
+    prevhashes.push_back(digest);
+    memcpy(digest.bytes, hash.data(), Sha256::Size);
+    hashes.push_back(digest);
+    memcpy(digest.bytes, block.signature.hash.data(), Sha256::Size);
+    signatureHashes.push_back(digest);
+
+    previds.push_back(block.previd);
+    timestamps.push_back(block.timestamp);
+    owners.push_back(InternKey(block.owner));
+    nonces.push_back(arena.Store(block.nonce));
+    datas.push_back(arena.Store(block.data));
+    signatures.push_back(arena.Store(block.signature.signature));
+    algorithms.push_back(block.signature.algorithm);
+    ids.push_back(block.id);
+
+    published.store(ids.size(), std::memory_order_release); // readers see the whole block or none of it
+    return true;
+}
+
+bool ChainStore::clear() {
+    size_t idle = 0;
+    if(!readers.compare_exchange_strong(idle, Clearing)) return false; // a snapshot still reads the columns
+
+    published.store(0, std::memory_order_relaxed);
+    ids.clear();
+    previds.clear();
+    timestamps.clear();
+    prevhashes.clear();
+    hashes.clear();
+    signatureHashes.clear();
+    owners.clear();
+    nonces.clear();
+    datas.clear();
+    signatures.clear();
+    algorithms.clear();
+    keyTable.clear();
+    keyIds.clear();
+    arena.Clear();
+
+    readers.fetch_sub(Clearing); // snapshots taken meanwhile saw the flag and hold no blocks
+    return true;
+}
+
+size_t ChainStore::MemoryUsage() const {
+    return ids.capacity() * sizeof(uint32_t) * 3
+         + timestamps.capacity() * sizeof(uint64_t)
+         + prevhashes.capacity() * sizeof(Digest) * 3
+         + nonces.capacity() * sizeof(std::string_view) * 3
+         + algorithms.capacity() * sizeof(SignatureAlgorithm)
+         + keyTable.capacity() * sizeof(std::string_view)
+         + keyIds.size() * (sizeof(std::string_view) + sizeof(uint32_t) + 2 * sizeof(void*))
+         + arena.Reserved();
+}
+
+ChainSnapshot::ChainSnapshot(const ChainStore* store): store(store), count(0) {
+    if(!(store->readers.fetch_add(1) & ChainStore::Clearing)) count = store->size(); // registered before the count is read
+}
+
+ChainSnapshot::ChainSnapshot(const ChainSnapshot& other): store(other.store), count(other.count) {
+    store->readers.fetch_add(1);
+}
+
+ChainSnapshot& ChainSnapshot::operator=(const ChainSnapshot& other) {
+    other.store->readers.fetch_add(1);
+    store->readers.fetch_sub(1);
+    store = other.store;
+    count = other.count;
+    return *this;
+}
+
+ChainSnapshot::~ChainSnapshot() {
+    store->readers.fetch_sub(1);
+}
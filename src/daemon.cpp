@@ -0,0 +1,395 @@
+#include "daemon.h"
+#include "metrics.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const size_t PageBlocks = 4096, PageBytes = size_t(4) << 20; // per GetChain answer, far below Transport::MaxFrame
+
+static size_t EncodedSize(const BlockView& block) { // upper bound, shared owner keys are only written once
+    return block.prevhash.size() + block.nonce.size() + block.owner.size() + block.data.size()
+         + block.signature.hash.size() + block.signature.signature.size() + 64;
+}
+
+static bool SameSecret(std::string_view a, std::string_view b) { // doesn't stop at the first difference
+    if(a.size() != b.size()) return false;
+
+    uint8_t difference = 0;
+    for(size_t i=0; i < a.size(); ++i) difference |= uint8_t(a[i] ^ b[i]);
+    return difference == 0;
+}
+
+Daemon::Daemon(Blockchain& chain, const std::string& database, const std::string& address, unsigned threads):
+    chain(chain), database(database), threads(threads), listener(address), cookiePath(database + ".cookie") {}
+
+Daemon::~Daemon() {
+    Stop();
+}
+
+bool Daemon::WriteCookie() {
+    std::string random = Crypto::prng_generate();
+    if(random.size() < 32){
+        std::cout << "Failed to generate the daemon cookie\n";
+        return false;
+    }
+
+    static const char digits[] = "0123456789abcdef";
+    cookie.clear();
+    for(size_t i=0; i < 32; ++i){
+        cookie += digits[uint8_t(random[i]) >> 4];
+        cookie += digits[uint8_t(random[i]) & 15];
+    }
+
+#ifdef _WIN32
+    std::ofstream file(cookiePath, std::ios::binary | std::ios::trunc); // as private as the database's directory
+    bool written = file.is_open() && (file << cookie).good();
+#else
+    // a file planted by another user fails the fchmod, a planted link fails the open
+    int fd = ::open(cookiePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+    bool written = (fd != -1 && fchmod(fd, 0600) == 0 && ::write(fd, cookie.data(), cookie.size()) == ssize_t(cookie.size()));
+    if(fd != -1) close(fd);
+#endif
+
+    if(!written) std::cout << "Failed to write the daemon cookie to " << cookiePath << "\n";
+    return written;
+}
+
+void Daemon::Run() {
+    if(!listener.IsLocal() && !WriteCookie()) return; // any local user can reach a TCP port
+
+    chain.StartSubmissions(database, threads);
+
+    while(std::unique_ptr<SocketTransport> peer = listener.Accept()){
+        std::lock_guard<std::mutex> guard(sessionLock);
+        for(auto it = sessions.begin(); it != sessions.end();){ // reap closed connections
+            if(it->done){
+                it->worker.join();
+                it = sessions.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        Session& session = sessions.emplace_back();
+        session.peer = std::move(peer);
+        session.trusted = listener.IsLocal(); // the socket file only lets its owner in
+        session.worker = std::thread(&Daemon::Serve, this, std::ref(session));
+    }
+
+    std::lock_guard<std::mutex> guard(sessionLock);
+    for(Session& session : sessions) session.peer->Close(); // wakes the idle ones
+    for(Session& session : sessions) session.worker.join();
+    sessions.clear();
+
+    chain.StopSubmissions();
+    if(!cookie.empty()) std::remove(cookiePath.c_str());
+}
+
+void Daemon::Stop() {
+    listener.Close();
+}
+
+void Daemon::Serve(Session& session) {
+    Transport& peer = *session.peer;
+    std::string request;
+
+    while(peer.ReceiveFrame(request)){
+        uint8_t type = (request.empty() ? 0 : uint8_t(request[0]));
+        if(type == uint8_t(SyncMessage::Hello)){
+            chain.ServeSync(peer, request); // the peer hangs up once it has the blocks
+            break;
+        }
+
+        DataManipulator reply;
+        Answer(session, request, reply);
+        if(!peer.SendFrame(reply.str())) break;
+
+        if(type == uint8_t(DaemonRequest::Stop) && session.trusted){
+            Stop();
+            break;
+        }
+    }
+
+    session.done = true;
+}
+
+void Daemon::Answer(Session& session, std::string_view request, DataManipulator& reply) {
+    DataManipulator reader(request.data(), request.size());
+    uint8_t type = 0;
+    reader.readLE(type);
+
+    DaemonStatus status = DaemonStatus::Ok;
+    std::vector<BlockView> found;
+    std::string text; // the encoded result
+    bool blocks = true; // the answer is the blocks found
+
+    switch(DaemonRequest(type)){
+        case DaemonRequest::AddBlock: {
+            if(!session.trusted){
+                status = DaemonStatus::Denied;
+                break;
+            }
+
+            uint32_t stem = 0;
+            std::string owner, data;
+            if(!reader.readLE(stem) || !reader.readVarString(owner) || !reader.readVarString(data)){
+                status = DaemonStatus::BadRequest;
+                break;
+            }
+
+            // concurrent adds from other connections are signed in the same batch
+            uint32_t id = chain.SubmitBlock(stem, owner, data).get();
+            BlockView created;
+            if(id == UINT32_MAX || !chain.GetBlock(id, created)){
+                status = DaemonStatus::Failed;
+                break;
+            }
+            found.push_back(created);
+            break;
+        }
+        case DaemonRequest::GetBlock: {
+            uint32_t id = 0;
+            BlockView block;
+            if(!reader.readLE(id)) status = DaemonStatus::BadRequest;
+            else if(chain.GetBlock(id, block)) found.push_back(block);
+            break;
+        }
+        case DaemonRequest::GetChain: { // a page per request, a chain of any size fits; doesn't hold up block creation
+            uint64_t from = 0;
+            if(!reader.readLE(from)){
+                status = DaemonStatus::BadRequest;
+                break;
+            }
+
+            ChainSnapshot snapshot = chain.GetBlockChain(); // kept until the page is encoded
+            size_t bytes = 0;
+            for(uint64_t pos = from; pos < snapshot.size() && found.size() < PageBlocks && bytes < PageBytes; ++pos){
+                found.push_back(snapshot[pos]);
+                bytes += EncodedSize(found.back());
+            }
+
+            uint64_t next = from + found.size();
+            DataManipulator page;
+            page.writeLE(uint64_t(next < snapshot.size() ? next : 0));
+            if(!Blockchain::EncodeBlocks(page, found)) status = DaemonStatus::Failed;
+            else text = page.str();
+            blocks = false;
+            break;
+        }
+        case DaemonRequest::GetLeaves:
+            found = chain.GetLeaves();
+            break;
+        case DaemonRequest::FindChildren: {
+            uint32_t id = 0;
+            if(!reader.readLE(id)) status = DaemonStatus::BadRequest;
+            else found = chain.FindChildren(id);
+            break;
+        }
+        case DaemonRequest::FindByOwner: {
+            std::string owner;
+            if(!reader.readVarString(owner)) status = DaemonStatus::BadRequest;
+            else found = chain.FindByOwner(owner);
+            break;
+        }
+        case DaemonRequest::FindInRange: {
+            uint64_t from = 0, to = 0;
+            if(!reader.readLE(from) || !reader.readLE(to)) status = DaemonStatus::BadRequest;
+            else found = chain.FindInRange(from, to);
+            break;
+        }
+        case DaemonRequest::Stats: {
+            uint8_t prometheus = 0;
+            if(!reader.readLE(prometheus)){
+                status = DaemonStatus::BadRequest;
+                break;
+            }
+            MetricsSnapshot snapshot = Metrics::Global().Snapshot();
+            DataManipulator formatted;
+            formatted.writeVarString(prometheus ? Metrics::FormatPrometheus(snapshot) : Metrics::FormatText(snapshot));
+            text = formatted.str();
+            blocks = false;
+            break;
+        }
+        case DaemonRequest::Stop:
+            if(!session.trusted) status = DaemonStatus::Denied;
+            blocks = false;
+            break;
+        case DaemonRequest::Auth: {
+            std::string presented;
+            if(!reader.readVarString(presented)) status = DaemonStatus::BadRequest;
+            else if(session.trusted || (!cookie.empty() && SameSecret(presented, cookie))) session.trusted = true;
+            else status = DaemonStatus::Denied;
+            blocks = false;
+            break;
+        }
+        default:
+            status = DaemonStatus::BadRequest;
+            break;
+    }
+
+    if(status == DaemonStatus::Ok && blocks){
+        DataManipulator encoded;
+        if(!Blockchain::EncodeBlocks(encoded, found)) status = DaemonStatus::Failed;
+        else text = encoded.str();
+    }
+
+    if(text.size() >= Transport::MaxFrame){ // the client would drop the connection on it
+        std::cout << "An answer of " << text.size() << " bytes doesn't fit in a frame\n";
+        status = DaemonStatus::Failed;
+    }
+
+    reply.writeLE(uint8_t(status));
+    if(status == DaemonStatus::Ok) reply.writeBytes(text.data(), text.size());
+}
+
+
+
+bool DaemonClient::Connect(const std::string& address) {
+    peer = SocketTransport::Connect(address);
+    return peer != nullptr;
+}
+
+bool DaemonClient::Authenticate(std::string_view cookie) {
+    DataManipulator request;
+    request.writeLE(uint8_t(DaemonRequest::Auth));
+    request.writeVarString(cookie);
+
+    std::string_view result;
+    return Request(request, result);
+}
+
+bool DaemonClient::Request(const DataManipulator& request, std::string_view& result) {
+    if(!peer || !peer->SendFrame(request.str()) || !peer->ReceiveFrame(answer) || answer.empty()){
+        std::cout << "The daemon closed the connection\n";
+        return false;
+    }
+
+    switch(DaemonStatus(answer[0])){
+        case DaemonStatus::Ok:
+            result = std::string_view(answer).substr(1);
+            return true;
+        case DaemonStatus::Failed:
+            std::cout << "The daemon failed the request\n";
+            return false;
+        case DaemonStatus::Denied:
+            std::cout << "The daemon denied the request, it needs the cookie next to its database\n";
+            return false;
+        default:
+            std::cout << "The daemon didn't understand the request\n";
+            return false;
+    }
+}
+
+bool DaemonClient::RequestBlocks(const DataManipulator& request, std::vector<BlockView>& found) {
+    std::string_view result;
+    if(!Request(request, result)) return false;
+
+    DataManipulator reader(result.data(), result.size());
+    if(!Blockchain::DecodeBlocks(reader, found)){
+        std::cout << "The daemon sent malformed blocks\n";
+        return false;
+    }
+    return true;
+}
+
+bool DaemonClient::AddBlock(uint32_t stem, const std::string& newOwner, const std::string& data, BlockView& created) {
+    DataManipulator request;
+    request.writeLE(uint8_t(DaemonRequest::AddBlock));
+    request.writeLE(stem);
+    request.writeVarString(newOwner);
+    request.writeVarString(data);
+
+    std::vector<BlockView> found;
+    if(!RequestBlocks(request, found) || found.size() != 1) return false;
+    created = found[0];
+    return true;
+}
+
+bool DaemonClient::GetBlock(uint32_t id, BlockView& found) {
+    DataManipulator request;
+    request.writeLE(uint8_t(DaemonRequest::GetBlock));
+    request.writeLE(id);
+
+    std::vector<BlockView> blocks;
+    if(!RequestBlocks(request, blocks) || blocks.empty()) return false;
+    found = blocks[0];
+    return true;
+}
+
+bool DaemonClient::GetBlockChain(const BlockPageCallback& page) {
+    std::vector<BlockView> found;
+    for(uint64_t from = 0;;){
+        DataManipulator request;
+        request.writeLE(uint8_t(DaemonRequest::GetChain));
+        request.writeLE(from);
+
+        std::string_view result;
+        if(!Request(request, result)) return false;
+
+        DataManipulator reader(result.data(), result.size());
+        uint64_t next = 0;
+        if(!reader.readLE(next) || !Blockchain::DecodeBlocks(reader, found) || (next != 0 && next <= from)){
+            std::cout << "The daemon sent a malformed page\n";
+            return false;
+        }
+
+        page(found);
+        if(next == 0) return true;
+        from = next;
+    }
+}
+
+bool DaemonClient::GetLeaves(std::vector<BlockView>& found) {
+    DataManipulator request;
+    request.writeLE(uint8_t(DaemonRequest::GetLeaves));
+    return RequestBlocks(request, found);
+}
+
+bool DaemonClient::FindChildren(uint32_t id, std::vector<BlockView>& found) {
+    DataManipulator request;
+    request.writeLE(uint8_t(DaemonRequest::FindChildren));
+    request.writeLE(id);
+    return RequestBlocks(request, found);
+}
+
+bool DaemonClient::FindByOwner(std::string_view owner, std::vector<BlockView>& found) {
+    DataManipulator request;
+    request.writeLE(uint8_t(DaemonRequest::FindByOwner));
+    request.writeVarString(owner);
+    return RequestBlocks(request, found);
+}
+
+bool DaemonClient::FindInRange(uint64_t from, uint64_t to, std::vector<BlockView>& found) {
+    DataManipulator request;
+    request.writeLE(uint8_t(DaemonRequest::FindInRange));
+    request.writeLE(from);
+    request.writeLE(to);
+    return RequestBlocks(request, found);
+}
+
+bool DaemonClient::Stats(bool prometheus, std::string& text) {
+    DataManipulator request;
+    request.writeLE(uint8_t(DaemonRequest::Stats));
+    request.writeLE(uint8_t(prometheus));
+
+    std::string_view result;
+    if(!Request(request, result)) return false;
+
+    DataManipulator reader(result.data(), result.size());
+    return reader.readVarString(text);
+}
+
+bool DaemonClient::Stop() {
+    DataManipulator request;
+    request.writeLE(uint8_t(DaemonRequest::Stop));
+
+    std::string_view result;
+    return Request(request, result);
+}
@@ -1,9 +1,167 @@
 #include "fileio.h"
+#include "metrics.h"
+
+#ifdef _WIN32
+#include "windows.h"
+#include <io.h>
+#include <climits>
+#include <fcntl.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& path): base(nullptr), length(0), open(false), file(INVALID_HANDLE_VALUE), mapping(NULL) {
+    METRIC_TIMER(FileRead);
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE) return;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size)) return;
+    length = size.QuadPart;
+    open = true;
+    if(length == 0) return; // nothing to map
+
+    mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mapping != NULL) base = reinterpret_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if(base == nullptr){
+        length = 0;
+        open = false;
+        return;
+    }
+
+    METRIC_COUNT(FileBytesRead, length);
+}
+
+MappedFile::~MappedFile() {
+    if(base != nullptr) UnmapViewOfFile(base);
+    if(mapping != NULL) CloseHandle(mapping);
+    if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+}
+#else
+MappedFile::MappedFile(const std::string& path): base(nullptr), length(0), open(false), fd(-1) {
+    METRIC_TIMER(FileRead);
+    fd = ::open(path.c_str(), O_RDONLY);
+    if(fd == -1) return;
+
+    struct stat info;
+    if(fstat(fd, &info) != 0) return;
+    length = info.st_size;
+    open = true;
+    if(length == 0) return; // nothing to map
+
+    void* view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(view == MAP_FAILED){
+        length = 0;
+        open = false;
+        return;
+    }
+
+    madvise(view, length, MADV_SEQUENTIAL); // the chain is parsed front to back
+    base = reinterpret_cast<const char*>(view);
+    METRIC_COUNT(FileBytesRead, length);
+}
+
+MappedFile::~MappedFile() {
+    if(base != nullptr) munmap(const_cast<char*>(base), length);
+    if(fd != -1) close(fd);
+}
+#endif
+
+
+static const struct Crc32cTable {
+    uint32_t entries[256];
+
+    Crc32cTable() {
+        for(uint32_t i=0; i < 256; ++i){
+            uint32_t crc = i;
+            for(int bit=0; bit < 8; ++bit) crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+            entries[i] = crc;
+        }
+    }
+} crcTable;
+
+uint32_t crc32c(const char* data, size_t size, uint32_t crc) {
+    crc = ~crc;
+    for(size_t i=0; i < size; ++i){
+        crc = crcTable.entries[(crc ^ uint8_t(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#ifdef _WIN32
+FileWriter::FileWriter(const std::string& path): fd(-1) {
+    fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+}
+
+FileWriter::~FileWriter() {
+    if(fd != -1) _close(fd);
+}
+
+bool FileWriter::Truncate(uint64_t size) {
+    return _chsize_s(fd, size) == 0;
+}
+
+bool FileWriter::WriteAt(uint64_t offset, const char* data, size_t size) {
+    METRIC_TIMER(FileWrite);
+    METRIC_COUNT(FileBytesWritten, size);
+    if(_lseeki64(fd, offset, SEEK_SET) == -1) return false;
+    while(size > 0){
+        int written = _write(fd, data, size > INT_MAX ? INT_MAX : unsigned(size));
+        if(written <= 0) return false;
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool FileWriter::Sync() {
+    METRIC_TIMER(FileWrite);
+    return _commit(fd) == 0;
+}
+#else
+FileWriter::FileWriter(const std::string& path): fd(-1) {
+    fd = ::open(path.c_str(), O_RDWR);
+}
+
+FileWriter::~FileWriter() {
+    if(fd != -1) close(fd);
+}
+
+bool FileWriter::Truncate(uint64_t size) {
+    return ftruncate(fd, size) == 0;
+}
+
+bool FileWriter::WriteAt(uint64_t offset, const char* data, size_t size) {
+    METRIC_TIMER(FileWrite);
+    METRIC_COUNT(FileBytesWritten, size);
+    while(size > 0){
+        ssize_t written = pwrite(fd, data, size, offset);
+        if(written <= 0) return false;
+        data += written;
+        size -= written;
+        offset += written;
+    }
+    return true;
+}
+
+bool FileWriter::Sync() {
+    METRIC_TIMER(FileWrite);
+    return fsync(fd) == 0;
+}
+#endif
 
 DataManipulator::DataManipulator(): readonly(false), error(false), pos(0), length(0), wdata( std::make_unique<std::stringstream>() ) {}
 DataManipulator::DataManipulator(const char* data, size_t length):
                                     readonly(true), error(false), pos(0), length(length), rdata(data) {}
 
+DataManipulator::~DataManipulator() {
+    if(!readonly) wdata.~unique_ptr(); // union member is not destroyed implicitly
+}
+
 
 bool DataManipulator::readString(std::string& rval) {
     if(!readonly) return false;
@@ -23,6 +181,95 @@ bool DataManipulator::readString(std::string& rval) {
     return true;
 };
 
+bool DataManipulator::readView(std::string_view& rval) {
+    if(!readonly) return false;
+    size_t sz;
+    if(!readData(sz)){
+        return false;
+    }
+
+    if(sz > length - pos){
+        error = true;
+        return false;
+    }
+
+    rval = std::string_view(rdata + pos, sz);
+
+    pos += sz;
+    return true;
+}
+
+bool DataManipulator::readView(std::string_view& rval, size_t size) {
+    if(!readonly) return false;
+
+    if(size > length - pos){
+        error = true;
+        return false;
+    }
+
+    rval = std::string_view(rdata + pos, size);
+
+    pos += size;
+    return true;
+}
+
+bool DataManipulator::readVarint(uint64_t& rval) {
+    if(!readonly) return false;
+
+    rval = 0;
+    for(int shift=0; shift < 64; shift += 7){
+        uint8_t byte;
+        if(!readData(byte)) return false;
+
+        rval |= uint64_t(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) return true;
+    }
+
+    error = true; // over-long encoding
+    return false;
+}
+
+bool DataManipulator::readVarView(std::string_view& rval) {
+    uint64_t sz;
+    if(!readVarint(sz)) return false;
+
+    return readView(rval, sz);
+}
+
+bool DataManipulator::readVarString(std::string& rval) {
+    std::string_view view;
+    if(!readVarView(view)) return false;
+
+    rval.assign(view);
+    return true;
+}
+
+bool DataManipulator::writeVarint(uint64_t rval) {
+    if(readonly) return false;
+
+    char bytes[10];
+    size_t n = 0;
+    do {
+        bytes[n] = char(rval & 0x7F);
+        rval >>= 7;
+        if(rval) bytes[n] |= 0x80;
+        ++n;
+    } while(rval);
+
+    return writeBytes(bytes, n);
+}
+
+bool DataManipulator::writeVarString(std::string_view rval) {
+    if(!writeVarint(rval.size())) return false;
+    return writeBytes(rval.data(), rval.size());
+}
+
+bool DataManipulator::writeBytes(const char* data, size_t size) {
+    if(readonly) return false;
+
+    return wdata->write(data, size).good();
+}
+
 bool DataManipulator::writeString(const std::string& rval) {
     if(readonly) return false;
     
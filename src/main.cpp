@@ -1,4 +1,6 @@
 #include "blockchain.h"
+#include "metrics.h"
+#include "daemon.h"
 #include <iostream>
 
 #ifdef _WIN32
@@ -108,13 +110,15 @@ int main(int argc, const char** argv) {
     Blockchain BlockO;
 
     do {
+        // signature algorithm of newly generated keys
+        SignatureAlgorithm algorithm = (FindArg("--ecdsa") ? SignatureAlgorithm::EcdsaP256 : SignatureAlgorithm::RsaPss);
 
         { // generate a new blockchain
             std::string newName;
             if(FindParam("newchain", newName)){
                 std::cout << "This will generate a new blockchain and overwrite the old blockchain.\nContinue?\n";
                 if(Confirm()){
-                    if(!BlockO.GenerateNewBlockChain(newName)){
+                    if(!BlockO.GenerateNewBlockChain(newName, 256, algorithm)){
                         std::cout << "Failed to generate new blockchain\n";
                         break;
                     }
@@ -135,7 +139,7 @@ int main(int argc, const char** argv) {
             if(FindParam("newkey", name)){
                 std::cout << "Generating New Keypair...\n";
 
-                BlockO.GenerateNewKeypair();
+                BlockO.GenerateNewKeypair(256, algorithm);
                 if(!BlockO.ExportKeys(name + ".pub", name + ".key")){
                     std::cout << "failed to generate new keypair\n";
                 }
@@ -144,19 +148,130 @@ int main(int argc, const char** argv) {
             }
         }
 
+        std::string clientaddress;
+        if(FindParam("client", clientaddress, 1)){ // ask a running daemon instead of loading the chain here
+            DaemonClient client;
+            if(!client.Connect(clientaddress)){
+                std::cout << "Failed to connect to the daemon at " << clientaddress << "\n";
+                break;
+            }
+
+            FindParam("database", database, 1);
+            std::string cookie = database + ".cookie"; // written by a daemon listening on a port
+            if(std::ifstream(cookie).good() && !client.Authenticate(LoadFileData(cookie))){
+                break;
+            }
+
+            std::string index, data, ownerfile, from, to;
+            std::vector<BlockView> found;
+            bool query = false;
+
+            if(FindParam("addblock", index, 1) && FindParam("addblock", data, 2)){
+                std::string key;
+                if(FindParam("ownerkey", ownerfile, 1)){
+                    key = LoadFileData(ownerfile);
+                    if(key.empty()){
+                        std::cout << "Failed to load owner key!\n";
+                        break;
+                    }
+                }
+
+                int64_t id;
+                BlockView created;
+                if(!ToInteger(index, id)){
+                    std::cout << "Failed because of an invalid index value\n";
+                } else if(client.AddBlock(id, key, data, created)){
+                    std::cout << "New block [" << created.id << "] was successfully added to blockchain!\n";
+                } else {
+                    std::cout << "Failed to add new block to the chain!\n";
+                }
+            }
+
+            if(FindParam("printblock", index, 1)){
+                int64_t id;
+                BlockView block;
+                if(!ToInteger(index, id)){
+                    std::cout << "Failed because of an invalid index value\n";
+                } else if(client.GetBlock(id, block)){
+                    Blockchain::PrintBlock(block);
+                } else {
+                    std::cout << "Could not find block\n";
+                }
+            }
+
+            if(FindArg("printchain")){ // printed as the pages come in
+                size_t count = 0;
+                bool done = client.GetBlockChain([&count](const std::vector<BlockView>& page){
+                    for(const BlockView& block : page){
+                        Blockchain::PrintBlock(block);
+                    }
+                    count += page.size();
+                });
+                if(done) std::cout << count << " blocks found\n";
+            }
+            if(FindArg("tips")) query = client.GetLeaves(found);
+
+            if(FindParam("children", index, 1)){
+                int64_t id;
+                query = ToInteger(index, id) && client.FindChildren(id, found);
+            }
+
+            if(FindParam("findowner", ownerfile, 1)){
+                std::string owner = LoadFileData(ownerfile);
+                query = !owner.empty() && client.FindByOwner(owner, found);
+            }
+
+            if(FindParam("range", from, 1) && FindParam("range", to, 2)){
+                int64_t first, last;
+                query = ToInteger(from, first) && ToInteger(to, last) && client.FindInRange(first, last, found);
+            }
+
+            if(query){
+                for(const BlockView& block : found){
+                    Blockchain::PrintBlock(block);
+                }
+                std::cout << found.size() << " blocks found\n";
+            }
+
+            if(FindArg("stats")){
+                std::string text;
+                if(client.Stats(FindArg("prometheus"), text)) std::cout << text;
+            }
+
+            if(FindArg("stop") && client.Stop()){
+                std::cout << "The daemon is stopping\n";
+            }
+            break;
+        }
+
         if(FindParam("database", database, 1)){
             std::cout << "Warning: A separate blockchain database has been selected\n";
         }
-        
-        // Import Blockchain Database
-        if(!BlockO.ImportBlockChain(database)){
-            std::cout << "Failed to import main blockchain database!\n";
+
+        if(FindArg("scanchain")){ // checksum pass over the database without importing it
+            ChainScan scan;
+            if(!Blockchain::ScanBlockChain(database, scan)){
+                std::cout << "Failed to scan blockchain database!\n";
+                break;
+            }
+
+            std::cout << "File version " << scan.version << ": " << scan.records << " records, " << scan.corrupt << " failed checksum";
+            if(scan.version < FILE_VERSION_INLINE_KEYS) std::cout << " (legacy format has no checksums)";
+            if(scan.truncated) std::cout << ", truncated final record";
+            std::cout << "\n";
             break;
         }
 
-        std::cout << "---------------------------------------------\n";
-        
-        { // load private key
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        {
+            std::string count;
+            int64_t value;
+            if(FindParam("threads", count, 1) && ToInteger(count, value) && value > 0){
+                threads = value;
+            }
+        }
+
+        { // load private key, a checkpoint signed with it lets the import skip verified signatures
             std::string privkey;
             if(FindParam("key", privkey)){
                 std::cout << "Loading private key...\n";
@@ -166,6 +281,53 @@ int main(int argc, const char** argv) {
             }
         }
 
+        { // self-check only every nth signature made by this run, 0 never
+            std::string every;
+            int64_t value;
+            if(FindParam("selfverify", every, 1) && ToInteger(every, value) && value >= 0){
+                BlockO.SetSelfVerify(value);
+            }
+        }
+
+        // blocks covered by a checkpoint signed with the current key skip signature verification
+        std::string checkpoint = database + ".checkpoint";
+        if(!FindArg("--full-verify")){
+            BlockO.UseCheckpoint(checkpoint);
+        }
+        
+        std::string syncaddress;
+        bool sync = FindParam("sync", syncaddress, 1);
+        if(sync && !std::ifstream(database).good()){
+            std::cout << "No local database, the chain comes from the peer\n";
+        } else {
+            // Import Blockchain Database, verified in the background while progress is reported here
+            std::shared_future<bool> import = BlockO.ImportBlockChainAsync(database, threads, [](const ImportProgress& progress){
+                std::cout << "verified " << progress.accepted + progress.rejected << " of " << progress.parsed << " blocks" << (progress.done ? "\n" : "\r") << std::flush;
+            });
+            if(!import.get()){
+                std::cout << "Failed to import main blockchain database!\n";
+                break;
+            }
+        }
+
+        std::cout << "---------------------------------------------\n";
+
+        if(sync){ // pull what a node serving on this machine has and we lack
+            std::unique_ptr<SocketTransport> peer = SocketTransport::Connect(syncaddress);
+            if(!peer){
+                std::cout << "Failed to connect to " << syncaddress << "\n";
+                break;
+            }
+
+            std::cout << "Syncing from " << syncaddress << "...\n";
+            if(!BlockO.SyncFrom(*peer, threads)){
+                std::cout << "Failed to sync with the peer!\n";
+            }
+            if(!BlockO.AppendBlockChain(database)){ // whatever was accepted is kept
+                std::cout << "Failed export blockchain database\n";
+            }
+        }
+        
         {
             std::string index, data, key;
             { // load owner public key
@@ -191,26 +353,58 @@ int main(int argc, const char** argv) {
                     break;
                 }
 
-                Block bfrom;
-                if(!BlockO.FindBlock(id, bfrom)){
+                BlockView bfrom;
+                if(!BlockO.GetBlock(id, bfrom)){
                     std::cout << "Failed because the stem block doesn't exist!\n";
                     break;
                 }
-                if(BlockO.CreateBlock(bfrom, key, data)){
+                if(BlockO.CreateBlock(bfrom.id, key, data)){
                     std::cout << "New block was successfully added to blockchain!\n";
 
                     std::cout << "Updating blockchain database...\n";
-                    if(!BlockO.ExportBlockChain(database)){
+                    if(!BlockO.AppendBlockChain(database)){
                         std::cout << "Failed export blockchain database\n";
                     }
                 } else {
                     std::cout << "Failed to add new block to the chain!\n";
                 }
             }
+
+            std::string batchfile;
+            if(FindParam("addblocks", batchfile, 1)){ // one "<block-index> <data-field>" per line
+                std::ifstream file(batchfile);
+                if(!file.is_open()){
+                    std::cout << "read file error\n";
+                    break;
+                }
+
+                std::vector<BlockRequest> requests;
+                std::string line;
+                while(std::getline(file, line)){
+                    if(line.empty()) continue;
+                    size_t split = line.find(' ');
+                    int64_t id;
+                    if(split == std::string::npos || !ToInteger(line.substr(0, split), id)){
+                        std::cout << "Failed because of an invalid batch line: " << line << "\n";
+                        requests.clear();
+                        break;
+                    }
+                    requests.push_back({ uint32_t(id), key, line.substr(split + 1) });
+                }
+
+                std::cout << "Inserting " << requests.size() << " new blocks into blockchain...\n";
+                if(!requests.empty() && BlockO.CreateBlocks(requests, database, threads)){
+                    std::cout << "New blocks were successfully added to blockchain!\n";
+                } else {
+                    std::cout << "Failed to add new blocks to the chain!\n";
+                }
+            }
         }
 
+        BlockO.WriteCheckpoint(checkpoint); // no-op without a private key or when nothing changed
+
         if(FindArg("printchain")){
-            for(const Block& block : BlockO.GetBlockChain()){
+            for(const BlockView& block : BlockO.GetBlockChain()){
                 Blockchain::PrintBlock(block);
             }
         }
@@ -223,14 +417,100 @@ int main(int argc, const char** argv) {
                     std::cout << "Failed because of an invalid index value\n";
                     break;
                 }
-                Block block;
-                if(!BlockO.FindBlock(id, block)){
+                BlockView block;
+                if(!BlockO.GetBlock(id, block)){
                     std::cout << "Could not find block\n";
                     break;
                 }
                 Blockchain::PrintBlock(block);
             }
         }
+
+        if(FindArg("tips")){ // leaves of the block tree, heaviest branch first
+            BlockView tip;
+            if(BlockO.GetCanonicalTip(tip)){
+                BlockWeight weight {};
+                BlockO.GetBlockWeight(tip.id, weight);
+                std::cout << "Canonical tip: [" << tip.id << "] depth " << weight.depth << ", work " << weight.work << "\n";
+            }
+
+            for(const BlockView& leaf : BlockO.GetLeaves()){
+                BlockWeight weight {};
+                BlockO.GetBlockWeight(leaf.id, weight);
+                std::cout << "Leaf [" << leaf.id << "] depth " << weight.depth << ", work " << weight.work << "\n";
+            }
+        }
+
+        if(FindArg("stats")){ // where the time went, "stats prometheus" for the text exposition format
+            MetricsSnapshot snapshot = Metrics::Global().Snapshot();
+            std::cout << (FindArg("prometheus") ? Metrics::FormatPrometheus(snapshot) : Metrics::FormatText(snapshot));
+        }
+
+        { // secondary index queries
+            std::string ownerfile, index, from, to;
+            std::vector<BlockView> found;
+            bool query = false;
+
+            if(FindParam("findowner", ownerfile, 1)){
+                std::string owner = LoadFileData(ownerfile);
+                if(owner.empty()){
+                    std::cout << "Failed to load owner key!\n";
+                    break;
+                }
+                found = BlockO.FindByOwner(owner);
+                query = true;
+            }
+
+            if(FindParam("children", index, 1)){
+                int64_t id;
+                if(!ToInteger(index, id)){
+                    std::cout << "Failed because of an invalid index value\n";
+                    break;
+                }
+                found = BlockO.FindChildren(id);
+                query = true;
+            }
+
+            if(FindParam("range", from, 1) && FindParam("range", to, 2)){
+                int64_t first, last;
+                if(!ToInteger(from, first) || !ToInteger(to, last)){
+                    std::cout << "Failed because of an invalid timestamp value\n";
+                    break;
+                }
+                found = BlockO.FindInRange(first, last);
+                query = true;
+            }
+
+            if(query){
+                for(const BlockView& block : found){
+                    Blockchain::PrintBlock(block);
+                }
+                std::cout << found.size() << " blocks found\n";
+            }
+        }
+
+        std::string serveaddress;
+        if(FindParam("serve", serveaddress, 1)){ // answer sync requests until killed
+            SocketListener listener(serveaddress);
+            if(!listener.IsOpen()) break;
+
+            std::cout << "Serving sync requests on " << listener.Address() << "\n" << std::flush;
+            while(std::unique_ptr<SocketTransport> peer = listener.Accept()){
+                std::cout << (BlockO.ServeSync(*peer) ? "served a sync request\n" : "sync request failed\n") << std::flush;
+            }
+        }
+
+        std::string daemonaddress;
+        if(FindParam("daemon", daemonaddress, 1)){ // keep the chain loaded and answer clients and sync requests until stopped
+            Daemon daemon(BlockO, database, daemonaddress, threads);
+            if(!daemon.IsOpen()) break;
+
+            std::cout << "Daemon listening on " << daemon.Address() << "\n" << std::flush;
+            daemon.Run();
+
+            BlockO.WriteCheckpoint(checkpoint);
+            std::cout << "Daemon stopped\n";
+        }
     } while(0);
 
     std::cout << "---------------------------------------------\n";
@@ -0,0 +1,121 @@
+#include "metrics.h"
+
+#include <sstream>
+
+Metrics::Metrics() {
+    Reset();
+}
+
+Metrics& Metrics::Global() {
+    static Metrics metrics;
+    return metrics;
+}
+
+void Metrics::Record(Timer timer, uint64_t ns) {
+    Histogram& histogram = timers[size_t(timer)];
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.totalNs.fetch_add(ns, std::memory_order_relaxed);
+
+    size_t bucket = 0;
+    for(uint64_t bound = 256; ns >= bound && bucket + 1 < HistogramSnapshot::Buckets; bound <<= 1) ++bucket;
+    histogram.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+MetricsSnapshot Metrics::Snapshot() const {
+    MetricsSnapshot snapshot;
+    for(size_t i=0; i < size_t(Counter::Count); ++i) snapshot.counters[i] = counters[i].load(std::memory_order_relaxed);
+    for(size_t i=0; i < size_t(Failure::Count); ++i) snapshot.failures[i] = failures[i].load(std::memory_order_relaxed);
+
+    for(size_t i=0; i < size_t(Timer::Count); ++i){
+        const Histogram& histogram = timers[i];
+        HistogramSnapshot& out = snapshot.timers[i];
+        out.count = histogram.count.load(std::memory_order_relaxed);
+        out.totalNs = histogram.totalNs.load(std::memory_order_relaxed);
+        for(size_t b=0; b < HistogramSnapshot::Buckets; ++b) out.buckets[b] = histogram.buckets[b].load(std::memory_order_relaxed);
+    }
+
+    return snapshot;
+}
+
+void Metrics::Reset() {
+    for(auto& counter : counters) counter.store(0, std::memory_order_relaxed);
+    for(auto& failure : failures) failure.store(0, std::memory_order_relaxed);
+
+    for(Histogram& histogram : timers){
+        histogram.count.store(0, std::memory_order_relaxed);
+        histogram.totalNs.store(0, std::memory_order_relaxed);
+        for(auto& bucket : histogram.buckets) bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+const char* Metrics::Name(Counter counter) {
+    static const char* names[] = {
+        "hash_calls", "hash_bytes",
+        "key_imports", "key_import_failures",
+        "signs", "verifies", "verify_failures",
+        "file_bytes_read", "file_bytes_written",
+        "blocks_accepted", "blocks_rejected"
+    };
+    return names[size_t(counter)];
+}
+
+const char* Metrics::Name(Timer timer) {
+    static const char* names[] = { "hash", "key_import", "sign", "verify", "file_read", "file_write" };
+    return names[size_t(timer)];
+}
+
+const char* Metrics::Name(Failure reason) {
+    static const char* names[] = { "no_parent", "bad_root", "broken_chain", "bad_key", "hash_mismatch", "bad_signature", "checksum" };
+    return names[size_t(reason)];
+}
+
+std::string Metrics::FormatText(const MetricsSnapshot& snapshot) {
+    std::stringstream out;
+    for(size_t i=0; i < size_t(Counter::Count); ++i){
+        out << Name(Counter(i)) << ": " << snapshot.counters[i] << "\n";
+    }
+
+    for(size_t i=0; i < size_t(Timer::Count); ++i){
+        const HistogramSnapshot& histogram = snapshot.timers[i];
+        out << Name(Timer(i)) << ": " << histogram.count << " calls, "
+            << (histogram.count ? histogram.totalNs / histogram.count : 0) << " ns mean, "
+            << histogram.totalNs / 1000000 << " ms total\n";
+    }
+
+    for(size_t i=0; i < size_t(Failure::Count); ++i){
+        out << "rejected " << Name(Failure(i)) << ": " << snapshot.failures[i] << "\n";
+    }
+
+    return out.str();
+}
+
+std::string Metrics::FormatPrometheus(const MetricsSnapshot& snapshot) {
+    std::stringstream out;
+    for(size_t i=0; i < size_t(Counter::Count); ++i){
+        out << "# TYPE blockchain_" << Name(Counter(i)) << "_total counter\n"
+            << "blockchain_" << Name(Counter(i)) << "_total " << snapshot.counters[i] << "\n";
+    }
+
+    for(size_t i=0; i < size_t(Timer::Count); ++i){
+        const HistogramSnapshot& histogram = snapshot.timers[i];
+        std::string name = std::string("blockchain_") + Name(Timer(i)) + "_seconds";
+
+        out << "# TYPE " << name << " histogram\n";
+        uint64_t cumulative = 0;
+        for(size_t b=0; b + 1 < HistogramSnapshot::Buckets; ++b){
+            cumulative += histogram.buckets[b];
+            out << name << "_bucket{le=\"" << double(uint64_t(256) << b) / 1e9 << "\"} " << cumulative << "\n";
+        }
+        cumulative += histogram.buckets[HistogramSnapshot::Buckets - 1];
+        out << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n"
+            << name << "_sum " << double(histogram.totalNs) / 1e9 << "\n"
+            << name << "_count " << cumulative << "\n";
+    }
+
+    out << "# TYPE blockchain_blocks_rejected_by_reason_total counter\n";
+    for(size_t i=0; i < size_t(Failure::Count); ++i){
+        out << "blockchain_blocks_rejected_by_reason_total{reason=\"" << Name(Failure(i)) << "\"} " << snapshot.failures[i] << "\n";
+    }
+
+    return out.str();
+}
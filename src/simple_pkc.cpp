@@ -1,17 +1,395 @@
 #include "simple_pkc.h"
+#include "metrics.h"
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+static int prng_idx = -1, hash_idx = -1; // process wide descriptor indices
+
+Sha256::Sha256() {
+    Reset();
+}
+
+void Sha256::Reset() {
+    sha256_init(&md);
+    bytes = 0;
+}
+
+void Sha256::Update(const void* data, size_t size) {
+    sha256_process(&md, reinterpret_cast<const uint8_t*>(data), size);
+    bytes += size;
+}
+
+void Sha256::Final(uint8_t (&out)[Size]) {
+    sha256_done(&md, out);
+    Reset();
+}
+
+std::string Sha256::Final() {
+    uint8_t out[Size];
+    Final(out);
+    return std::string(reinterpret_cast<const char*>(out), Size);
+}
+
+
+
+class RsaPssKey : public SignatureScheme::Key {
+    rsa_key key;
+
+public:
+    explicit RsaPssKey(const rsa_key& parsed): key(parsed) {}
+    ~RsaPssKey() { rsa_free(&key); }
+
+    bool IsPrivate() const override { return key.type == PK_PRIVATE; }
+    const rsa_key* Rsa() const override { return &key; }
+
+    std::string Export(int type) const override {
+        char out[1024 * 6];
+        unsigned long len = sizeof(out);
+        int code = rsa_export((uint8_t*)out, &len, type, &key);
+        if(code != CRYPT_OK){
+            std::cout << "key failure: " << error_to_string(code) << "\n";
+            return "";
+        }
+        return std::string(out, len);
+    }
+
+    std::string SignHash(std::string_view hash, int saltLength) const override {
+        char out[1024 * 2];
+        unsigned long len = sizeof(out);
+        int code = rsa_sign_hash((const uint8_t*)hash.data(), hash.size(), (uint8_t*)out, &len, NULL, prng_idx, hash_idx, saltLength, &key);
+        if(code != CRYPT_OK){
+            std::cout << "key failure: " << error_to_string(code) << "\n";
+            return "";
+        }
+        return std::string(out, len);
+    }
+
+    bool VerifyHash(std::string_view sighash, std::string_view hash, int saltLength) const override {
+        int status;
+        int code = rsa_verify_hash((const uint8_t*)sighash.data(), sighash.size(), (const uint8_t*)hash.data(), hash.size(), hash_idx, saltLength, &status, &key);
+        return code == CRYPT_OK && status == 1;
+    }
+};
+
+class RsaPssScheme : public SignatureScheme {
+public:
+    SignatureAlgorithm Algorithm() const override { return SignatureAlgorithm::RsaPss; }
+    const char* Name() const override { return "rsa-pss"; }
+
+    int Import(std::string_view der, std::unique_ptr<Key>& key) const override {
+        rsa_key parsed;
+        int code = rsa_import((const uint8_t*)der.data(), der.size(), &parsed);
+        if(code == CRYPT_OK) key.reset(new RsaPssKey(parsed));
+        return code;
+    }
+
+    int Generate(int size, std::unique_ptr<Key>& key) const override {
+        rsa_key parsed;
+        int code = rsa_make_key(NULL, prng_idx, size, 65537, &parsed);
+        if(code == CRYPT_OK) key.reset(new RsaPssKey(parsed));
+        return code;
+    }
+};
+
+class EcdsaP256Key : public SignatureScheme::Key { // signatures are DER encoded (r, s), the salt length doesn't apply
+    mutable ecc_key key; // older libtomcrypt releases take non-const keys everywhere
+
+public:
+    explicit EcdsaP256Key(const ecc_key& parsed): key(parsed) {}
+    ~EcdsaP256Key() { ecc_free(&key); }
+
+    bool IsPrivate() const override { return key.type == PK_PRIVATE; }
+
+    std::string Export(int type) const override {
+        char out[1024];
+        unsigned long len = sizeof(out);
+        int code = ecc_export((uint8_t*)out, &len, type, &key);
+        if(code != CRYPT_OK){
+            std::cout << "key failure: " << error_to_string(code) << "\n";
+            return "";
+        }
+        return std::string(out, len);
+    }
+
+    std::string SignHash(std::string_view hash, int) const override {
+        char out[256];
+        unsigned long len = sizeof(out);
+        int code = ecc_sign_hash((const uint8_t*)hash.data(), hash.size(), (uint8_t*)out, &len, NULL, prng_idx, &key);
+        if(code != CRYPT_OK){
+            std::cout << "key failure: " << error_to_string(code) << "\n";
+            return "";
+        }
+        return std::string(out, len);
+    }
+
+    bool VerifyHash(std::string_view sighash, std::string_view hash, int) const override {
+        int status;
+        int code = ecc_verify_hash((const uint8_t*)sighash.data(), sighash.size(), (const uint8_t*)hash.data(), hash.size(), &status, &key);
+        return code == CRYPT_OK && status == 1;
+    }
+};
+
+class EcdsaP256Scheme : public SignatureScheme {
+public:
+    SignatureAlgorithm Algorithm() const override { return SignatureAlgorithm::EcdsaP256; }
+    const char* Name() const override { return "ecdsa-p256"; }
+
+    int Import(std::string_view der, std::unique_ptr<Key>& key) const override {
+        ecc_key parsed;
+        int code = ecc_import((const uint8_t*)der.data(), der.size(), &parsed);
+        if(code != CRYPT_OK) return code;
+
+        if(ecc_get_size(&parsed) != 32){ // another curve
+            ecc_free(&parsed);
+            return CRYPT_INVALID_PACKET;
+        }
+        key.reset(new EcdsaP256Key(parsed));
+        return CRYPT_OK;
+    }
+
+    int Generate(int, std::unique_ptr<Key>& key) const override {
+        ecc_key parsed;
+        int code = ecc_make_key(NULL, prng_idx, 32, &parsed);
+        if(code == CRYPT_OK) key.reset(new EcdsaP256Key(parsed));
+        return code;
+    }
+};
+
+const SignatureScheme* const* SignatureScheme::List(size_t& count) {
+    static const RsaPssScheme rsaPss;
+    static const EcdsaP256Scheme ecdsaP256;
+    static const SignatureScheme* const schemes[] = { &rsaPss, &ecdsaP256 };
+
+    count = sizeof(schemes) / sizeof(schemes[0]);
+    return schemes;
+}
+
+const SignatureScheme* SignatureScheme::Find(SignatureAlgorithm algorithm) {
+    size_t count;
+    const SignatureScheme* const* schemes = List(count);
+    for(size_t i=0; i < count; ++i){
+        if(schemes[i]->Algorithm() == algorithm) return schemes[i];
+    }
+    return nullptr;
+}
+
+
+
+CryptoKey::CryptoKey(const SignatureScheme* scheme, std::unique_ptr<SignatureScheme::Key>&& parsed): scheme(scheme), key(std::move(parsed)) {}
+
+CryptoKey CryptoKey::Import(std::string_view der) {
+    if(!Crypto::System()) return CryptoKey();
+
+    METRIC_TIMER(KeyImport);
+    METRIC_COUNT(KeyImports, 1);
+    size_t count;
+    const SignatureScheme* const* schemes = SignatureScheme::List(count);
+    int code = CRYPT_INVALID_PACKET;
+    for(size_t i=0; i < count; ++i){
+        std::unique_ptr<SignatureScheme::Key> parsed;
+        code = schemes[i]->Import(der, parsed);
+        if(code == CRYPT_OK) return CryptoKey(schemes[i], std::move(parsed));
+    }
+
+    METRIC_COUNT(KeyImportFailures, 1);
+    std::cout << "key failure: " << error_to_string(code) << "\n";
+    return CryptoKey();
+}
+
+CryptoKey CryptoKey::Import(std::string_view der, SignatureAlgorithm algorithm) {
+    if(!Crypto::System()) return CryptoKey();
+
+    METRIC_TIMER(KeyImport);
+    METRIC_COUNT(KeyImports, 1);
+    const SignatureScheme* scheme = SignatureScheme::Find(algorithm);
+    std::unique_ptr<SignatureScheme::Key> parsed;
+    int code = (scheme ? scheme->Import(der, parsed) : CRYPT_INVALID_ARG);
+    if(code != CRYPT_OK){
+        METRIC_COUNT(KeyImportFailures, 1);
+        std::cout << "key failure: " << error_to_string(code) << "\n";
+        return CryptoKey();
+    }
+
+    return CryptoKey(scheme, std::move(parsed));
+}
+
+CryptoKey CryptoKey::Generate(int size, SignatureAlgorithm algorithm) {
+    if(!Crypto::System()) return CryptoKey();
+
+    const SignatureScheme* scheme = SignatureScheme::Find(algorithm);
+    std::unique_ptr<SignatureScheme::Key> parsed;
+    int code = (scheme ? scheme->Generate(size, parsed) : CRYPT_INVALID_ARG);
+    if(code != CRYPT_OK){
+        std::cout << "key failure: " << error_to_string(code) << "\n";
+        return CryptoKey();
+    }
+
+    return CryptoKey(scheme, std::move(parsed));
+}
+
+std::string CryptoKey::ExportPublicKey() const {
+    if(!IsValid()) return "";
+    return key->Export(PK_PUBLIC);
+}
+
+std::string CryptoKey::ExportPrivateKey() const {
+    if(!IsPrivate()) return "";
+    return key->Export(PK_PRIVATE);
+}
+
+std::string CryptoKey::SignHash(std::string_view hash, int saltLength) const {
+    if(!IsPrivate()) return "";
+
+    METRIC_TIMER(Sign);
+    METRIC_COUNT(Signs, 1);
+    return key->SignHash(hash, saltLength);
+}
+
+bool CryptoKey::VerifyHash(std::string_view sighash, std::string_view hash, int saltLength) const {
+    if(!IsValid()) return false;
+
+    METRIC_TIMER(Verify);
+    METRIC_COUNT(Verifies, 1);
+    if(!key->VerifyHash(sighash, hash, saltLength)){
+        METRIC_COUNT(VerifyFailures, 1);
+        return false;
+    }
+
+    return true;
+}
+
+
+
+KeyCache::KeyCache(size_t capacity): capacity(capacity), hits(0), misses(0) {}
+
+CryptoKey KeyCache::Get(std::string_view der) {
+    Sha256 md; // not Crypto::sha256_hash, a lookup isn't a hash call worth counting
+    md.Update(der);
+    std::string id = md.Final();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = entries.find(id);
+        if(it != entries.end()){
+            order.splice(order.begin(), order, it->second); // mark as most recently used
+            ++hits;
+            return it->second->second;
+        }
+        ++misses;
+    }
+
+    CryptoKey key = CryptoKey::Import(der); // decode outside the lock
+    if(!key.IsValid()) return key; // never cache a failed import
+
+    std::lock_guard<std::mutex> guard(lock);
+    if(capacity == 0 || entries.count(id)) return key; // disabled, or another thread got here first
+
+    order.emplace_front(id, key);
+    entries.emplace(std::move(id), order.begin());
+    while(entries.size() > capacity){
+        entries.erase(order.back().first);
+        order.pop_back();
+    }
+
+    return key;
+}
+
+void KeyCache::Clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    entries.clear();
+    order.clear();
+}
+
+void KeyCache::SetCapacity(size_t size) {
+    std::lock_guard<std::mutex> guard(lock);
+    capacity = size;
+    while(entries.size() > capacity){
+        entries.erase(order.back().first);
+        order.pop_back();
+    }
+}
+
+CryptoKey KeyCache::Get(std::string_view der, SignatureAlgorithm algorithm) {
+    // a DER encoding only parses as one algorithm, so the key's own id is enough
+    CryptoKey key = Get(der);
+    return (key.IsValid() && key.Algorithm() == algorithm) ? key : CryptoKey();
+}
+
+KeyCacheStats KeyCache::Stats() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return { hits, misses, entries.size(), capacity };
+}
+
+
+
+template<class Task>
+static void ParallelFor(size_t count, unsigned threads, Task task) { // workers claim runs of items, so neighbours mostly share a thread
+    const size_t claim = 16;
+    std::atomic<size_t> cursor(0);
+    auto work = [&] {
+        for(size_t first = cursor.fetch_add(claim); first < count; first = cursor.fetch_add(claim)){
+            for(size_t i = first; i < std::min(count, first + claim); ++i) task(i);
+        }
+    };
+
+    unsigned workers = unsigned(std::min<size_t>(threads, (count + claim - 1) / claim));
+    if(workers <= 1) return work();
+
+    std::vector<std::thread> pool;
+    for(unsigned t=0; t < workers; ++t) pool.emplace_back(work);
+    for(std::thread& th : pool) th.join();
+}
+
+SigningSession::SigningSession(const CryptoKey& key, size_t verifyEvery): key(key), verifyEvery(verifyEvery), count(0) {}
+
+void SigningSession::Reset(const CryptoKey& newKey) {
+    key = newKey;
+    count = 0;
+}
+
+std::string SigningSession::SignHash(std::string_view hash) {
+    std::string signature = key.SignHash(hash);
+    if(signature.empty()) return "";
+
+    size_t n = count.fetch_add(1, std::memory_order_relaxed);
+    if(verifyEvery != 0 && n % verifyEvery == 0 && !key.VerifyHash(signature, hash)){
+        std::cout << "signature failed its self-check\n";
+        return "";
+    }
+
+    return signature;
+}
+
+std::vector<std::string> SigningSession::SignHashes(const std::vector<std::string_view>& hashes, unsigned threads) {
+    std::vector<std::string> signatures(hashes.size());
+    ParallelFor(hashes.size(), threads, [&](size_t i) {
+        signatures[i] = SignHash(hashes[i]);
+    });
+    return signatures;
+}
+
+
 
 Crypto::Crypto(): salt_length(8), error(false) {
-    if(!InitSystem()){
+    if(!System()){
         error = true;
     }
 }
 
-Crypto::~Crypto() {
-    unregister_hash(&sha256_desc);
-    unregister_prng(&sprng_desc);
+Crypto::~Crypto() {}
+
+bool Crypto::System() {
+    static std::once_flag once;
+    static bool ready = false;
+
+    std::call_once(once, [] { ready = InitSystem(); });
+    return ready;
 }
 
+int Crypto::HashIndex() { return hash_idx; }
+int Crypto::PrngIndex() { return prng_idx; }
+
 bool Crypto::InitSystem() {
     if(register_prng(&sprng_desc) == -1){
         std::cout << "prng failure\n";
@@ -36,7 +414,12 @@ bool Crypto::InitSystem() {
     return true;
 }
 
-std::string Crypto::sha256_hash(const std::string& data) {
+std::string Crypto::sha256_hash(std::string_view data) {
+    if(!System()) return "";
+
+    METRIC_TIMER(Hash);
+    METRIC_COUNT(HashCalls, 1);
+    METRIC_COUNT(HashBytes, data.size());
     char hashbuf[32]; // SHA256 32 bytes
     unsigned long hashlen = sizeof(hashbuf);
     int code = hash_memory(hash_idx, (const uint8_t*)data.data(), data.size(), (uint8_t*)hashbuf, &hashlen);
@@ -50,7 +433,7 @@ std::string Crypto::sha256_hash(const std::string& data) {
 
 std::string Crypto::prng_generate() {
     uint8_t out[64];
-    
+
     unsigned long read = sprng_read(out, sizeof(out), NULL);
     if(!read){
         std::cout << "sprng failed\n";
@@ -61,71 +444,66 @@ std::string Crypto::prng_generate() {
     return data;
 }
 
-bool Crypto::GenerateKeypair(int size) {
-    int code = rsa_make_key(NULL, prng_idx, size, 65537, &keypair);
-    if(code != CRYPT_OK){
-        std::cout << "key failure: " << error_to_string(code) << "\n";
-        return false;
+std::vector<bool> Crypto::VerifyBatch(const std::vector<VerifyRequest>& requests, unsigned threads, KeyCache* cache, int saltLength) {
+    // group the requests by key, then lay them out group after group
+    std::unordered_map<std::string_view, size_t> groups;
+    std::vector<std::string_view> groupKeys;
+    std::vector<size_t> groupOf(requests.size());
+    for(size_t i=0; i < requests.size(); ++i){
+        auto it = groups.emplace(requests[i].key, groupKeys.size()).first;
+        if(it->second == groupKeys.size()) groupKeys.push_back(requests[i].key);
+        groupOf[i] = it->second;
     }
 
-    return true;
+    std::vector<size_t> next(groupKeys.size() + 1, 0), order(requests.size());
+    for(size_t group : groupOf) ++next[group + 1];
+    for(size_t g=0; g < groupKeys.size(); ++g) next[g + 1] += next[g];
+    for(size_t i=0; i < requests.size(); ++i) order[next[groupOf[i]]++] = i;
+
+    std::vector<CryptoKey> keys(groupKeys.size());
+    ParallelFor(keys.size(), threads, [&](size_t g) {
+        keys[g] = (cache ? cache->Get(groupKeys[g]) : CryptoKey::Import(groupKeys[g]));
+    });
+
+    std::vector<uint8_t> verified(requests.size(), 0); // one byte per request, workers never share a word of a bitmap
+    ParallelFor(order.size(), threads, [&](size_t k) {
+        const VerifyRequest& request = requests[order[k]];
+        const CryptoKey& key = keys[groupOf[order[k]]];
+        verified[order[k]] = key.IsValid() && key.Algorithm() == request.algorithm && key.VerifyHash(request.signature, request.hash, saltLength);
+    });
+
+    return std::vector<bool>(verified.begin(), verified.end());
 }
 
-bool Crypto::ImportKey(const std::string& key) {
-    int code = rsa_import((const uint8_t*)key.data(), key.size(), &keypair);
-    if(code != CRYPT_OK){
-        std::cout << "key failure: " << error_to_string(code) << "\n";
-        return false;
-    }
+bool Crypto::GenerateKeypair(int size, SignatureAlgorithm algorithm) {
+    keypair = CryptoKey::Generate(size, algorithm);
+    return keypair.IsValid();
+}
 
-    return true;
+bool Crypto::ImportKey(const std::string& key) {
+    keypair = CryptoKey::Import(key);
+    return keypair.IsValid();
 }
 
 void Crypto::ClearKeys() {
-    memset(reinterpret_cast<char*>(&keypair), 0, sizeof(keypair)); // zero-memory key
+    keypair = CryptoKey(); // drops this context's reference to the key
 }
 
 std::string Crypto::ExportPublicKey() {
-    std::string key;
-    char out[1024 * 6];
-    unsigned long len = sizeof(out);
-    
-    if(keypair.N == NULL) return "";
-
-    int code = rsa_export((uint8_t*)out, &len, PK_PUBLIC, &keypair);
-    if(code != CRYPT_OK){
-        std::cout << "key failure: " << error_to_string(code) << "\n";
-        return "";
-    }
-
-    key.assign(out, len);
-    return key;
+    return keypair.ExportPublicKey();
 }
 
 std::string Crypto::ExportPrivateKey() {
-    if(keypair.type != PK_PRIVATE) return "";
-
-    std::string key;
-    char out[1024 * 6];
-    unsigned long len = sizeof(out);
-    
-    if(keypair.N == NULL) return "";
-
-    int code = rsa_export((uint8_t*)out, &len, PK_PRIVATE, &keypair);
-    if(code != CRYPT_OK){
-        std::cout << "key failure: " << error_to_string(code) << "\n";
-        return "";
-    }
-
-    key.assign(out, len);
-    return key;
+    return keypair.ExportPrivateKey();
 }
 
 std::string Crypto::EncryptKey(const std::string& key) {
+    if(keypair.Rsa() == nullptr) return ""; // key encryption is RSA only
+
     std::string output;
     char out[1024 * 6];
     unsigned long len = sizeof(out);
-    int code = rsa_encrypt_key((const uint8_t*)key.data(), key.size(), (uint8_t*)out, &len, nullptr, 0, NULL, prng_idx, hash_idx, &keypair);
+    int code = rsa_encrypt_key((const uint8_t*)key.data(), key.size(), (uint8_t*)out, &len, nullptr, 0, NULL, prng_idx, hash_idx, keypair.Rsa());
     if(code != CRYPT_OK){
         std::cout << "key failure: " << error_to_string(code) << "\n";
         return "";
@@ -136,13 +514,13 @@ std::string Crypto::EncryptKey(const std::string& key) {
 }
 
 std::string Crypto::DecryptKey(const std::string& enckey) {
-    if(keypair.type != PK_PRIVATE) return "";
+    if(!keypair.IsPrivate() || keypair.Rsa() == nullptr) return "";
 
     std::string output;
     char out[1024 * 6];
     unsigned long len = sizeof(out);
     int status;
-    int code = rsa_decrypt_key((const uint8_t*)enckey.data(), enckey.size(), (uint8_t*)out, &len, nullptr, 0, hash_idx, &status, &keypair);
+    int code = rsa_decrypt_key((const uint8_t*)enckey.data(), enckey.size(), (uint8_t*)out, &len, nullptr, 0, hash_idx, &status, keypair.Rsa());
     if(code != CRYPT_OK){
         std::cout << "key failure: " << error_to_string(code) << "\n";
         return "";
@@ -156,53 +534,17 @@ std::string Crypto::DecryptKey(const std::string& enckey) {
 }
 
 std::string Crypto::SignData(const std::string& data) {
-    if(keypair.type != PK_PRIVATE) return "";
-
-    std::string hash = sha256_hash(data);
-    std::string output;
-    char out[1024 * 2];
-    unsigned long len = sizeof(out);
-    int code = rsa_sign_hash((const uint8_t*)hash.data(), hash.size(), (uint8_t*)out, &len, NULL, prng_idx, hash_idx, salt_length, &keypair);
-    if(code != CRYPT_OK){
-        std::cout << "key failure: " << error_to_string(code) << "\n";
-        return "";
-    }
-
-    output.assign(out, len);
-    return output;
+    return keypair.SignHash(sha256_hash(data), salt_length);
 }
 
 std::string Crypto::SignHash(const std::string& hash) {
-    if(keypair.type != PK_PRIVATE) return "";
-
-    std::string output;
-    char out[1024 * 2];
-    unsigned long len = sizeof(out);
-    int code = rsa_sign_hash((const uint8_t*)hash.data(), hash.size(), (uint8_t*)out, &len, NULL, prng_idx, hash_idx, salt_length, &keypair);
-    if(code != CRYPT_OK){
-        std::cout << "key failure: " << error_to_string(code) << "\n";
-        return "";
-    }
-
-    output.assign(out, len);
-    return output;
+    return keypair.SignHash(hash, salt_length);
 }
 
 bool Crypto::VerifyData(const std::string& sighash, const std::string& data) {
-    std::string hash = sha256_hash(data);
-
-    int status;
-    int code = rsa_verify_hash((const uint8_t*)sighash.data(), sighash.size(), (const uint8_t*)hash.data(), hash.size(), hash_idx, salt_length, &status, &keypair);
-    if(code != CRYPT_OK) return false;
-
-    return (status == 1);
+    return keypair.VerifyHash(sighash, sha256_hash(data), salt_length);
 }
 
 bool Crypto::VerifyHash(const std::string& sighash, const std::string& hash) {
-
-    int status;
-    int code = rsa_verify_hash((const uint8_t*)sighash.data(), sighash.size(), (const uint8_t*)hash.data(), hash.size(), hash_idx, salt_length, &status, &keypair);
-    if(code != CRYPT_OK) return false;
-
-    return (status == 1);
-}
\ No newline at end of file
+    return keypair.VerifyHash(sighash, hash, salt_length);
+}
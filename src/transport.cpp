@@ -0,0 +1,313 @@
+#include "transport.h"
+
+#include <iostream>
+#include <climits>
+#include <cstring>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mutex>
+#else
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL // a closed peer fails the send instead of raising SIGPIPE
+#else
+#define SEND_FLAGS 0
+#endif
+
+static bool SocketSystem() {
+#ifdef _WIN32
+    static std::once_flag once;
+    static bool ready = false;
+
+    std::call_once(once, [] {
+        WSADATA data;
+        ready = (WSAStartup(MAKEWORD(2, 2), &data) == 0);
+    });
+    return ready;
+#else
+    return true;
+#endif
+}
+
+static void CloseSocket(intptr_t sock, bool wake) {
+    if(sock == -1) return;
+#ifdef _WIN32
+    closesocket(SOCKET(sock)); // also wakes blocked calls
+#else
+    if(wake) shutdown(int(sock), SHUT_RDWR); // close alone doesn't wake a thread blocked on the socket
+    close(int(sock));
+#endif
+}
+
+static bool Interrupted() { // the call should simply be retried
+#ifdef _WIN32
+    return false;
+#else
+    return errno == EINTR;
+#endif
+}
+
+static sockaddr_in LoopbackAddress(uint16_t port) {
+    sockaddr_in address {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return address;
+}
+
+static void NoDelay(intptr_t sock) { // frames are small and answered one by one
+    int on = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+}
+
+static bool ParsePort(const std::string& address, uint16_t& port) { // anything else is a socket path
+    if(address.empty() || address.size() > 5 || address.find_first_not_of("0123456789") != std::string::npos) return false;
+
+    unsigned long value = std::stoul(address);
+    if(value > UINT16_MAX) return false;
+    port = uint16_t(value);
+    return true;
+}
+
+#ifndef _WIN32
+static bool LocalAddress(const std::string& path, sockaddr_un& address) {
+    address = sockaddr_un {};
+    address.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(address.sun_path)){
+        std::cout << "socket path " << path << " is too long\n";
+        return false;
+    }
+    memcpy(address.sun_path, path.data(), path.size());
+    return true;
+}
+#endif
+
+
+
+bool Transport::SendFrame(std::string_view payload) {
+    if(payload.size() > UINT32_MAX) return false;
+
+    char length[4];
+    for(size_t i=0; i < sizeof(length); ++i) length[i] = char(uint32_t(payload.size()) >> (8 * i));
+    return Send(length, sizeof(length)) && Send(payload.data(), payload.size());
+}
+
+bool Transport::ReceiveFrame(std::string& payload, size_t limit) {
+    uint8_t length[4];
+    if(!Receive(reinterpret_cast<char*>(length), sizeof(length))) return false;
+
+    size_t size = 0;
+    for(size_t i=0; i < sizeof(length); ++i) size |= size_t(length[i]) << (8 * i);
+    if(size > limit){
+        std::cout << "frame of " << size << " bytes exceeds the limit\n";
+        return false;
+    }
+
+    payload.resize(size);
+    return Receive(payload.data(), size);
+}
+
+
+
+SocketTransport::SocketTransport(intptr_t sock): sock(sock) {}
+
+SocketTransport::~SocketTransport() {
+    CloseSocket(sock.exchange(-1), false);
+}
+
+std::unique_ptr<SocketTransport> SocketTransport::Connect(uint16_t port) {
+    if(!SocketSystem()) return nullptr;
+
+    intptr_t sock = intptr_t(::socket(AF_INET, SOCK_STREAM, 0));
+    if(sock == -1) return nullptr;
+
+    sockaddr_in address = LoopbackAddress(port);
+    if(::connect(sock, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0){
+        CloseSocket(sock, false);
+        return nullptr;
+    }
+
+    NoDelay(sock);
+    return std::unique_ptr<SocketTransport>(new SocketTransport(sock));
+}
+
+std::unique_ptr<SocketTransport> SocketTransport::Connect(const std::string& address) {
+    uint16_t port;
+    if(ParsePort(address, port)) return (port != 0 ? Connect(port) : nullptr);
+
+#ifdef _WIN32
+    std::cout << "local sockets aren't supported here, connect to a port\n";
+    return nullptr;
+#else
+    sockaddr_un local;
+    if(!LocalAddress(address, local)) return nullptr;
+
+    intptr_t sock = intptr_t(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if(sock == -1) return nullptr;
+
+    if(::connect(sock, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0){
+        CloseSocket(sock, false);
+        return nullptr;
+    }
+    return std::unique_ptr<SocketTransport>(new SocketTransport(sock));
+#endif
+}
+
+bool SocketTransport::Send(const char* data, size_t size) {
+    while(size > 0){
+        int chunk = int(std::min<size_t>(size, INT_MAX));
+        auto sent = ::send(sock, data, chunk, SEND_FLAGS);
+        if(sent <= 0){
+            if(sent < 0 && Interrupted()) continue;
+            return false;
+        }
+
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool SocketTransport::Receive(char* data, size_t size) {
+    while(size > 0){
+        int chunk = int(std::min<size_t>(size, INT_MAX));
+        auto read = ::recv(sock, data, chunk, 0);
+        if(read <= 0){
+            if(read < 0 && Interrupted()) continue;
+            return false; // closed by the peer, or failed
+        }
+
+        data += read;
+        size -= read;
+    }
+    return true;
+}
+
+void SocketTransport::Close() {
+    CloseSocket(sock.exchange(-1), true);
+}
+
+
+
+SocketListener::SocketListener(uint16_t port): sock(-1) {
+    Listen(port);
+}
+
+SocketListener::SocketListener(const std::string& address): sock(-1) {
+    uint16_t port;
+    if(ParsePort(address, port)) Listen(port);
+    else ListenLocal(address);
+}
+
+void SocketListener::Listen(uint16_t port) {
+    if(!SocketSystem()) return;
+
+    intptr_t fd = intptr_t(::socket(AF_INET, SOCK_STREAM, 0));
+    if(fd == -1) return;
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+
+    sockaddr_in address = LoopbackAddress(port);
+    if(::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(fd, 16) != 0){
+        std::cout << "failed to listen on port " << port << "\n";
+        CloseSocket(fd, false);
+        return;
+    }
+
+    sock = fd;
+}
+
+void SocketListener::ListenLocal(const std::string& socketPath) {
+#ifdef _WIN32
+    std::cout << "local sockets aren't supported here, listen on a port\n";
+#else
+    sockaddr_un address;
+    if(!LocalAddress(socketPath, address)) return;
+
+    intptr_t fd = intptr_t(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if(fd == -1) return;
+
+    struct stat existing;
+    if(lstat(socketPath.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)){ // left behind unless something still answers on it
+        intptr_t probe = intptr_t(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if(probe != -1 && ::connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 && errno == ECONNREFUSED){
+            unlink(socketPath.c_str());
+        }
+        CloseSocket(probe, false);
+    }
+
+    // created 0600 rather than chmod-ed after bind, so nobody else can connect in between; listeners are made before threads start
+    mode_t mask = umask(0177);
+    bool bound = (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0);
+    umask(mask);
+
+    if(!bound || ::listen(fd, 16) != 0){
+        std::cout << "failed to listen on " << socketPath << "\n";
+        if(bound) unlink(socketPath.c_str());
+        CloseSocket(fd, false);
+        return;
+    }
+
+    path = socketPath;
+    sock = fd;
+#endif
+}
+
+SocketListener::~SocketListener() {
+    intptr_t fd = sock.exchange(-1);
+    if(fd == -1) return;
+
+    CloseSocket(fd, false);
+#ifndef _WIN32
+    if(!path.empty()) unlink(path.c_str());
+#endif
+}
+
+uint16_t SocketListener::Port() const {
+    if(!path.empty()) return 0;
+
+    sockaddr_in address {};
+    socklen_t size = sizeof(address);
+    if(getsockname(sock, reinterpret_cast<sockaddr*>(&address), &size) != 0) return 0;
+    return ntohs(address.sin_port);
+}
+
+std::string SocketListener::Address() const {
+    return (path.empty() ? std::to_string(Port()) : path);
+}
+
+std::unique_ptr<SocketTransport> SocketListener::Accept() {
+    for(;;){
+        intptr_t fd = sock;
+        if(fd == -1) return nullptr;
+
+        intptr_t client = intptr_t(::accept(fd, nullptr, nullptr));
+        if(client != -1){
+            if(path.empty()) NoDelay(client);
+            return std::unique_ptr<SocketTransport>(new SocketTransport(client));
+        }
+        if(!Interrupted()) return nullptr;
+    }
+}
+
+void SocketListener::Close() {
+    intptr_t fd = sock.exchange(-1);
+    if(fd == -1) return;
+
+    CloseSocket(fd, true);
+#ifndef _WIN32
+    if(!path.empty()) unlink(path.c_str()); // new clients fail to connect instead of waiting on a dead socket
+#endif
+}
@@ -0,0 +1,93 @@
+#include "test.h"
+
+static uint64_t ImportVerifies(Blockchain& chain, const std::string& path) {
+    uint64_t before = CounterValue(Counter::Verifies);
+    CHECK(chain.ImportBlockChain(path));
+    return CounterValue(Counter::Verifies) - before;
+}
+
+TEST(CheckpointSkipsVerifiedPrefix) {
+    Blockchain source;
+    CHECK(BuildForkedChain(source, "checkpoint"));
+
+    std::string path = TempPath("checkpoint.chain"), checkpoint = TempPath("checkpoint.ckpt");
+    CHECK(source.ExportBlockChain(path));
+    CHECK(source.WriteCheckpoint(checkpoint));
+
+    Blockchain full;
+    CHECK(ImportVerifies(full, path) == source.GetBlockChainSize());
+
+    Blockchain trusted;
+    CHECK(ShareKeys(source, trusted));
+    trusted.UseCheckpoint(checkpoint);
+    CHECK(ImportVerifies(trusted, path) == 1); // the checkpoint's own signature only
+    CHECK(BlockSet(trusted) == BlockSet(source));
+
+    // blocks appended after the checkpoint are still verified
+    CHECK(source.CreateBlock(60, "", "past the checkpoint"));
+    CHECK(source.AppendBlockChain(path));
+
+    Blockchain extended;
+    CHECK(ShareKeys(source, extended));
+    extended.UseCheckpoint(checkpoint);
+    CHECK(ImportVerifies(extended, path) == 2);
+    CHECK(BlockSet(extended) == BlockSet(source));
+}
+
+TEST(TamperedCheckpointIgnored) {
+    Blockchain source;
+    CHECK(BuildForkedChain(source, "tampered"));
+
+    std::string path = TempPath("tampered.chain"), checkpoint = TempPath("tampered.ckpt");
+    CHECK(source.ExportBlockChain(path));
+    CHECK(source.WriteCheckpoint(checkpoint));
+
+    // claims fewer records than were signed for
+    std::string bytes = ReadFileBytes(checkpoint);
+    CHECK(bytes.size() > 8);
+    bytes[8] ^= 1;
+    CHECK(WriteFileBytes(checkpoint, bytes));
+
+    Blockchain chain;
+    CHECK(ShareKeys(source, chain));
+    chain.UseCheckpoint(checkpoint);
+    CHECK(ImportVerifies(chain, path) == source.GetBlockChainSize() + 1); // the checkpoint, then every block
+    CHECK(BlockSet(chain) == BlockSet(source));
+}
+
+TEST(ForeignCheckpointIgnored) {
+    Blockchain source;
+    CHECK(BuildForkedChain(source, "foreign"));
+
+    std::string path = TempPath("foreign.chain"), checkpoint = TempPath("foreign.ckpt");
+    CHECK(source.ExportBlockChain(path));
+    CHECK(source.WriteCheckpoint(checkpoint));
+
+    // a valid checkpoint, but signed by somebody else than the importing user
+    Blockchain stranger;
+    CHECK(stranger.GenerateNewKeypair(32, SignatureAlgorithm::EcdsaP256));
+    stranger.UseCheckpoint(checkpoint);
+    CHECK(ImportVerifies(stranger, path) == source.GetBlockChainSize());
+    CHECK(BlockSet(stranger) == BlockSet(source));
+}
+
+TEST(CheckpointDoesNotCoverTamperedBlock) {
+    Blockchain source;
+    CHECK(BuildForkedChain(source, "covered"));
+
+    std::string path = TempPath("covered.chain"), checkpoint = TempPath("covered.ckpt");
+    CHECK(source.ExportBlockChain(path));
+    CHECK(source.WriteCheckpoint(checkpoint));
+
+    // a forged signature inside the covered range, with a valid record checksum
+    CHECK(TamperRecord(path, 30, true, true));
+
+    Blockchain chain;
+    CHECK(ShareKeys(source, chain));
+    chain.UseCheckpoint(checkpoint);
+    CHECK(ImportVerifies(chain, path) > 0); // the whole file is checked again
+
+    BlockView block;
+    CHECK(!chain.GetBlock(30, block));
+    CHECK(chain.GetBlock(29, block));
+}
@@ -0,0 +1,74 @@
+#include "test.h"
+
+TEST(FileRoundTrip) {
+    Blockchain source;
+    CHECK(BuildChain(source, "roundtrip", 20));
+
+    std::string path = TempPath("roundtrip.chain");
+    CHECK(source.ExportBlockChain(path));
+
+    ChainScan scan {};
+    CHECK(Blockchain::ScanBlockChain(path, scan));
+    CHECK(scan.version == FILE_VERSION);
+    CHECK(scan.records == 21);
+    CHECK(scan.corrupt == 0);
+    CHECK(!scan.truncated);
+
+    Blockchain copy;
+    CHECK(copy.ImportBlockChain(path));
+    CHECK(copy.GetBlockChainSize() == 21);
+    CHECK(BlockSet(copy) == BlockSet(source));
+
+    BlockView block;
+    CHECK(copy.GetBlock(7, block) && block.data == "block 7" && block.previd == 6);
+
+    // a re-export of the imported chain is byte for byte the same file
+    std::string again = TempPath("roundtrip2.chain");
+    CHECK(copy.ExportBlockChain(again));
+    CHECK(ReadFileBytes(again) == ReadFileBytes(path));
+}
+
+TEST(ChecksumMismatchRejected) {
+    Blockchain source;
+    CHECK(BuildChain(source, "checksum", 10));
+
+    std::string path = TempPath("checksum.chain");
+    CHECK(source.ExportBlockChain(path));
+    CHECK(TamperRecord(path, 10, false, false)); // last block, nothing stems from it
+
+    ChainScan scan {};
+    CHECK(Blockchain::ScanBlockChain(path, scan));
+    CHECK(scan.records == 11);
+    CHECK(scan.corrupt == 1);
+    CHECK(!scan.truncated);
+
+    uint64_t checksumFailures = FailureValue(Failure::Checksum);
+    uint64_t verifies = CounterValue(Counter::Verifies);
+
+    Blockchain copy;
+    CHECK(copy.ImportBlockChain(path));
+    CHECK(copy.GetBlockChainSize() == 10);
+
+    BlockView block;
+    CHECK(!copy.GetBlock(10, block));
+    CHECK(copy.GetBlock(9, block));
+    CHECK(FailureValue(Failure::Checksum) == checksumFailures + 1);
+    CHECK(CounterValue(Counter::Verifies) - verifies == 10); // the corrupt record never reached signature checks
+}
+
+TEST(ScanFindsTornRecord) {
+    Blockchain source;
+    CHECK(BuildChain(source, "scan", 6));
+
+    std::string path = TempPath("scan.chain");
+    CHECK(source.ExportBlockChain(path));
+
+    std::string bytes = ReadFileBytes(path);
+    CHECK(WriteFileBytes(path, bytes.substr(0, bytes.size() - 20)));
+
+    ChainScan scan {};
+    CHECK(Blockchain::ScanBlockChain(path, scan));
+    CHECK(scan.records == 6);
+    CHECK(scan.corrupt == 0);
+    CHECK(scan.truncated);
+}
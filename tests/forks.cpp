@@ -0,0 +1,75 @@
+#include "test.h"
+
+static std::set<uint32_t> Ids(const std::vector<BlockView>& blocks) {
+    std::set<uint32_t> ids;
+    for(const BlockView& block : blocks) ids.insert(block.id);
+    return ids;
+}
+
+static void CheckWeight(Blockchain& chain, uint32_t id, uint32_t depth) {
+    BlockWeight weight {};
+    CHECK(chain.GetBlockWeight(id, weight));
+    CHECK(weight.depth == depth);
+    CHECK(weight.work == uint64_t(depth) + 1); // every block is one unit of work
+}
+
+static void CheckForkTree(Blockchain& chain) {
+    // 0 - 1 - 2 - 3 - 4
+    //      \- 5 - 6
+    //          \- 7
+    CHECK(Ids(chain.GetLeaves()) == std::set<uint32_t>({ 4, 6, 7 }));
+
+    CheckWeight(chain, 0, 0);
+    CheckWeight(chain, 4, 4);
+    CheckWeight(chain, 6, 3);
+    CheckWeight(chain, 7, 3);
+
+    BlockView tip;
+    CHECK(chain.GetCanonicalTip(tip) && tip.id == 4);
+
+    CHECK(Ids(chain.FindChildren(1)) == std::set<uint32_t>({ 2, 5 }));
+    CHECK(Ids(chain.FindChildren(5)) == std::set<uint32_t>({ 6, 7 }));
+    CHECK(chain.FindChildren(4).empty());
+
+    BlockWeight weight;
+    CHECK(!chain.GetBlockWeight(99, weight));
+}
+
+TEST(LeavesAndWeights) {
+    Blockchain chain;
+    CHECK(NewChain(chain, "forks"));
+
+    BlockView tip;
+    CHECK(chain.GetCanonicalTip(tip) && tip.id == 0);
+    CHECK(Ids(chain.GetLeaves()) == std::set<uint32_t>({ 0 }));
+
+    CHECK(chain.CreateBlocks({ { 0, "", "a" }, { 1, "", "b" }, { 2, "", "c" }, { 3, "", "d" } }));
+    CHECK(chain.CreateBlocks({ { 1, "", "e" }, { 5, "", "f" }, { 5, "", "g" } }));
+    CheckForkTree(chain);
+
+    // the side branch catches up: a tie keeps the tip that was seen first, a heavier branch takes over
+    CHECK(chain.CreateBlock(6, "", "h")); // 8, depth 4
+    CHECK(chain.GetCanonicalTip(tip) && tip.id == 4);
+    CHECK(Ids(chain.GetLeaves()) == std::set<uint32_t>({ 4, 7, 8 }));
+
+    CHECK(chain.CreateBlock(8, "", "i")); // 9, depth 5
+    CHECK(chain.GetCanonicalTip(tip) && tip.id == 9);
+    CheckWeight(chain, 9, 5);
+    CHECK(Ids(chain.GetLeaves()) == std::set<uint32_t>({ 4, 7, 9 }));
+}
+
+TEST(LeavesSurviveReload) {
+    Blockchain chain;
+    CHECK(NewChain(chain, "reload"));
+    CHECK(chain.CreateBlocks({ { 0, "", "a" }, { 1, "", "b" }, { 2, "", "c" }, { 3, "", "d" } }));
+    CHECK(chain.CreateBlocks({ { 1, "", "e" }, { 5, "", "f" }, { 5, "", "g" } }));
+
+    std::string path = TempPath("forks.chain");
+    CHECK(chain.ExportBlockChain(path));
+
+    Blockchain sequential, parallel;
+    CHECK(sequential.ImportBlockChain(path, 1));
+    CHECK(parallel.ImportBlockChain(path, 4));
+    CheckForkTree(sequential);
+    CheckForkTree(parallel);
+}
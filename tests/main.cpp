@@ -0,0 +1,170 @@
+#include "test.h"
+
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <random>
+
+static size_t failures = 0;
+static std::filesystem::path tempDirectory; // created on first use, removed when the runner exits
+
+std::vector<TestCase>& TestCases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+void TestFailure(const char* file, int line, const char* expression) {
+    std::cerr << "  " << file << ":" << line << ": CHECK(" << expression << ") failed\n";
+    ++failures;
+}
+
+std::string TempPath(const std::string& name) {
+    if(tempDirectory.empty()){
+        std::random_device random;
+        std::error_code error;
+        do {
+            tempDirectory = std::filesystem::temp_directory_path() / ("blockchain_test_" + std::to_string(random()));
+        } while(!std::filesystem::create_directory(tempDirectory, error) && !error); // taken by another run
+    }
+
+    return (tempDirectory / name).string();
+}
+
+std::string ReadFileBytes(const std::string& path) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    std::stringstream bytes;
+    bytes << file.rdbuf();
+    return bytes.str();
+}
+
+bool WriteFileBytes(const std::string& path, const std::string& bytes) {
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open()) return false;
+
+    return file.write(bytes.data(), bytes.size()).good();
+}
+
+bool NewChain(Blockchain& chain, const std::string& name) {
+    return chain.GenerateNewBlockChain(name, 32, SignatureAlgorithm::EcdsaP256);
+}
+
+bool BuildChain(Blockchain& chain, const std::string& name, uint32_t blocks) {
+    if(!NewChain(chain, name)) return false;
+
+    std::vector<BlockRequest> requests;
+    for(uint32_t i=0; i < blocks; ++i) requests.push_back({ i, "", "block " + std::to_string(i + 1) });
+    return chain.CreateBlocks(requests);
+}
+
+bool BuildForkedChain(Blockchain& chain, const std::string& name) {
+    if(!NewChain(chain, name)) return false;
+
+    // rejected blocks cut off subtrees of different sizes
+    std::vector<BlockRequest> requests;
+    for(uint32_t i=0; i < 60; ++i){
+        uint32_t stem = (i % 7 == 3 ? i / 2 : i);
+        requests.push_back({ stem, "", "payload " + std::to_string(i + 1) });
+    }
+    return chain.CreateBlocks(requests, "", 4);
+}
+
+bool ShareKeys(Blockchain& from, Blockchain& to) {
+    std::string pub = TempPath("share.pub"), priv = TempPath("share.key");
+    return from.ExportKeys(pub, priv) && to.ImportKey(pub, PK_PUBLIC) && to.ImportKey(priv, PK_PRIVATE);
+}
+
+std::set<std::pair<uint32_t, std::string>> BlockSet(Blockchain& chain) {
+    std::set<std::pair<uint32_t, std::string>> blocks;
+    ChainSnapshot snapshot = chain.GetBlockChain();
+    for(const BlockView& view : snapshot){
+        Block block = view.ToBlock();
+        blocks.emplace(block.id, chain.CalculateBlockHash(block));
+    }
+    return blocks;
+}
+
+uint64_t CounterValue(Counter counter) {
+    return Metrics::Global().Snapshot().counters[size_t(counter)];
+}
+
+uint64_t FailureValue(Failure reason) {
+    return Metrics::Global().Snapshot().failures[size_t(reason)];
+}
+
+bool TamperRecord(const std::string& path, uint32_t id, bool signature, bool fixCrc) {
+    std::string bytes = ReadFileBytes(path);
+    if(bytes.size() < FILE_COUNT_OFFSET + sizeof(uint64_t)) return false;
+
+    // walks current format records: id, previd, timestamp, prevhash, key reference (owner inline if 0), nonce, data,
+    // signature hash, algorithm, signature, CRC32C of everything before it
+    DataManipulator reader(bytes.data(), bytes.size());
+    uint32_t fileId = 0, version = 0;
+    uint64_t count = 0;
+    std::string_view field;
+    if(!reader.readLE(fileId) || !reader.readLE(version) || !reader.readLE(count) || !reader.readVarView(field)) return false;
+    if(version != FILE_VERSION) return false;
+
+    while(reader.remaining() > 0){
+        size_t start = reader.tell();
+        uint32_t recordId = 0, previd = 0;
+        uint64_t timestamp = 0, keyRef = 0;
+        uint8_t algorithm = 0;
+        std::string_view data, sig;
+
+        bool valid = reader.readLE(recordId) && reader.readLE(previd) && reader.readLE(timestamp);
+        valid = valid && reader.readView(field, 32) && reader.readVarint(keyRef);
+        if(valid && keyRef == 0) valid = reader.readVarView(field);
+        valid = valid && reader.readVarView(field) && reader.readVarView(data);
+        valid = valid && reader.readView(field, 32) && reader.readLE(algorithm) && reader.readVarView(sig);
+        size_t end = reader.tell();
+        uint32_t crc = 0;
+        if(!valid || !reader.readLE(crc)) return false;
+
+        if(recordId != id) continue;
+
+        std::string_view target = (signature ? sig : data);
+        if(target.empty()) return false;
+        bytes[target.data() - bytes.data()] ^= 1;
+
+        if(fixCrc){
+            crc = crc32c(bytes.data() + start, end - start);
+            for(size_t i=0; i < sizeof(crc); ++i) bytes[end + i] = char(crc >> (8 * i));
+        }
+        return WriteFileBytes(path, bytes);
+    }
+
+    return false;
+}
+
+int main(int argc, char** argv) {
+    std::string filter = (argc > 1 ? argv[1] : ""); // runs only the cases whose name contains it
+
+    size_t run = 0, failed = 0;
+    std::streambuf* console = std::cout.rdbuf();
+    std::ostringstream muted; // library output is only shown for failing cases
+
+    for(const TestCase& test : TestCases()){
+        if(std::string(test.name).find(filter) == std::string::npos) continue;
+
+        std::cerr << "[ RUN  ] " << test.name << "\n";
+        size_t before = failures;
+        muted.str("");
+        std::cout.rdbuf(muted.rdbuf());
+        test.run();
+        std::cout.rdbuf(console);
+
+        ++run;
+        if(failures != before){
+            ++failed;
+            std::cerr << muted.str() << "[ FAIL ] " << test.name << "\n";
+        } else {
+            std::cerr << "[  OK  ] " << test.name << "\n";
+        }
+    }
+
+    std::error_code error;
+    if(!tempDirectory.empty()) std::filesystem::remove_all(tempDirectory, error);
+
+    std::cerr << run - failed << "/" << run << " tests passed\n";
+    return failed == 0 ? 0 : 1;
+}
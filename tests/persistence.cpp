@@ -0,0 +1,116 @@
+#include "test.h"
+
+#include <filesystem>
+
+TEST(AppendWritesOnlyNewRecords) {
+    Blockchain source;
+    CHECK(BuildChain(source, "append", 5));
+
+    std::string path = TempPath("append.chain");
+    CHECK(source.ExportBlockChain(path));
+    std::string exported = ReadFileBytes(path);
+
+    CHECK(source.CreateBlock(5, "", "appended 6"));
+    CHECK(source.AppendBlockChain(path));
+
+    // the records already on disk are left as they were, only the block count in the header changes
+    std::string appended = ReadFileBytes(path);
+    CHECK(appended.size() > exported.size());
+    const size_t start = FILE_COUNT_OFFSET + sizeof(uint64_t);
+    CHECK(appended.compare(start, exported.size() - start, exported, start) == 0);
+
+    // and the result is the file a full export writes
+    std::string full = TempPath("append_full.chain");
+    CHECK(source.ExportBlockChain(full));
+    CHECK(ReadFileBytes(full) == appended);
+}
+
+TEST(TruncatedAppendRecovered) {
+    Blockchain source;
+    CHECK(BuildChain(source, "truncated", 5));
+
+    std::string path = TempPath("truncated.chain");
+    CHECK(source.ExportBlockChain(path));
+    CHECK(source.CreateBlock(5, "", "appended 6"));
+    CHECK(source.CreateBlock(6, "", "appended 7"));
+    CHECK(source.AppendBlockChain(path));
+
+    // an append torn halfway through its last record
+    std::string bytes = ReadFileBytes(path);
+    CHECK(WriteFileBytes(path, bytes.substr(0, bytes.size() - 20)));
+
+    Blockchain copy;
+    CHECK(ShareKeys(source, copy));
+    CHECK(copy.ImportBlockChain(path));
+    CHECK(copy.GetBlockChainSize() == 7);
+
+    BlockView block;
+    CHECK(copy.GetBlock(6, block) && block.data == "appended 6");
+    CHECK(!copy.GetBlock(7, block));
+
+    // the next append replaces the torn tail
+    CHECK(copy.CreateBlock(6, "", "after recovery"));
+    CHECK(copy.AppendBlockChain(path));
+
+    Blockchain reloaded;
+    CHECK(reloaded.ImportBlockChain(path));
+    CHECK(reloaded.GetBlockChainSize() == 8);
+    CHECK(BlockSet(reloaded) == BlockSet(copy));
+}
+
+TEST(BatchIsAllOrNothing) {
+    Blockchain chain;
+    CHECK(BuildChain(chain, "batch", 3));
+
+    std::string path = TempPath("batch.chain");
+    CHECK(chain.ExportBlockChain(path));
+    std::string before = ReadFileBytes(path);
+
+    // the last request stems off a block that doesn't exist, so none of the batch is kept
+    CHECK(!chain.CreateBlocks({ { 3, "", "a" }, { 4, "", "b" }, { 99, "", "c" } }, path));
+    CHECK(chain.GetBlockChainSize() == 4);
+    CHECK(ReadFileBytes(path) == before);
+
+    CHECK(chain.CreateBlocks({ { 3, "", "a" }, { 4, "", "b" } }, path));
+    BlockView block;
+    CHECK(chain.GetBlock(5, block) && block.data == "b" && block.previd == 4);
+
+    Blockchain reloaded;
+    CHECK(reloaded.ImportBlockChain(path));
+    CHECK(BlockSet(reloaded) == BlockSet(chain));
+}
+
+TEST(BatchWriteFailureStoresNothing) {
+    Blockchain chain;
+    CHECK(BuildChain(chain, "unwritten", 3));
+    auto stored = BlockSet(chain);
+
+    // nowhere to write a new file
+    std::string missing = TempPath("missing") + "/directory/batch.chain";
+    CHECK(!chain.CreateBlocks({ { 3, "", "a" }, { 4, "", "b" } }, missing));
+    CHECK(BlockSet(chain) == stored);
+
+    BlockView block;
+    CHECK(!chain.GetBlock(4, block));
+
+    // an append to a file that can't be opened any more
+    std::string path = TempPath("unwritten.chain");
+    CHECK(chain.ExportBlockChain(path));
+    std::filesystem::remove(path);
+    std::filesystem::create_directory(path);
+
+    CHECK(!chain.CreateBlocks({ { 3, "", "a" } }, path));
+    CHECK(BlockSet(chain) == stored);
+    CHECK(!chain.GetBlock(4, block));
+
+    // nothing of the failed batches comes out later, and their ids are handed out again
+    std::filesystem::remove(path);
+    CHECK(chain.ExportBlockChain(path));
+    CHECK(chain.CreateBlocks({ { 3, "", "c" } }, path));
+    CHECK(chain.GetBlock(4, block) && block.data == "c");
+
+    Blockchain reloaded;
+    CHECK(reloaded.ImportBlockChain(path));
+    CHECK(reloaded.GetBlockChainSize() == 5);
+    CHECK(BlockSet(reloaded) == BlockSet(chain));
+}
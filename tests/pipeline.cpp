@@ -0,0 +1,127 @@
+#include "test.h"
+
+#include <thread>
+#include <chrono>
+#include <mutex>
+
+TEST(PipelinedMatchesSequential) {
+    Blockchain source;
+    CHECK(BuildForkedChain(source, "pipelined"));
+
+    std::string path = TempPath("pipelined.chain");
+    CHECK(source.ExportBlockChain(path));
+
+    const uint32_t tampered[] = { 5, 23, 41, 58 };
+    for(uint32_t id : tampered) CHECK(TamperRecord(path, id, true, true));
+
+    std::mutex lock;
+    std::vector<ImportProgress> reports;
+    Blockchain sequential, pipelined;
+    CHECK(sequential.ImportBlockChain(path, 1));
+    CHECK(pipelined.ImportBlockChainAsync(path, 4, [&](const ImportProgress& progress) {
+        std::lock_guard<std::mutex> guard(lock);
+        reports.push_back(progress);
+    }).get());
+
+    CHECK(BlockSet(pipelined) == BlockSet(sequential));
+    BlockView block;
+    for(uint32_t id : tampered) CHECK(!pipelined.GetBlock(id, block));
+
+    // progress only moves forward and the last report accounts for every record
+    CHECK(!reports.empty());
+    bool forward = true;
+    for(size_t i=1; i < reports.size(); ++i){
+        forward = forward && reports[i].accepted >= reports[i - 1].accepted && reports[i].rejected >= reports[i - 1].rejected;
+    }
+    CHECK(forward);
+    if(!reports.empty()){
+        const ImportProgress& last = reports.back();
+        CHECK(last.done);
+        CHECK(last.parsed == source.GetBlockChainSize());
+        CHECK(last.accepted == pipelined.GetBlockChainSize());
+        CHECK(last.accepted + last.rejected == last.parsed);
+    }
+}
+
+TEST(PipelinedImportQueryable) {
+    Blockchain source;
+    CHECK(BuildChain(source, "queryable", 2000));
+
+    std::string path = TempPath("queryable.chain");
+    CHECK(source.ExportBlockChain(path));
+
+    // queries run while blocks are still arriving and only ever see whole blocks
+    Blockchain chain;
+    std::shared_future<bool> done = chain.ImportBlockChainAsync(path, 2);
+    bool consistent = true;
+    while(done.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready){
+        size_t size = chain.GetBlockChainSize();
+        BlockView block;
+        if(size > 0) consistent = consistent && chain.GetBlock(uint32_t(size - 1), block) && block.id == size - 1;
+    }
+    CHECK(done.get());
+    CHECK(consistent);
+    CHECK(BlockSet(chain) == BlockSet(source));
+}
+
+TEST(BlockingQueueDrainsAfterClose) {
+    BlockingQueue<int> queue(4);
+    for(int i=0; i < 3; ++i) CHECK(queue.push(int(i)));
+    queue.close();
+
+    CHECK(!queue.push(99)); // refused once closed
+
+    int item = -1;
+    for(int i=0; i < 3; ++i) CHECK(queue.pop(item) && item == i); // what was queued is still handed out, in order
+    CHECK(!queue.pop(item));
+    CHECK(!queue.pop(item));
+}
+
+TEST(BlockingQueueCloseWakesWaiters) {
+    BlockingQueue<int> empty(1);
+    bool popped = true;
+    std::thread consumer([&] { int item; popped = empty.pop(item); });
+
+    BlockingQueue<int> full(1);
+    CHECK(full.push(1));
+    bool pushed = true;
+    std::thread producer([&] { pushed = full.push(2); });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50)); // both are blocked by now
+    empty.close();
+    full.close();
+    consumer.join();
+    producer.join();
+
+    CHECK(!popped);
+    CHECK(!pushed);
+
+    int item = 0;
+    CHECK(full.pop(item) && item == 1);
+    CHECK(!full.pop(item));
+}
+
+TEST(BlockingQueueHandsOffEveryItem) {
+    BlockingQueue<int> queue(8);
+    const int producers = 4, perProducer = 1000;
+
+    std::vector<std::thread> threads;
+    for(int p=0; p < producers; ++p){
+        threads.emplace_back([&queue, p] {
+            for(int i=0; i < perProducer; ++i) queue.push(p * perProducer + i);
+        });
+    }
+
+    std::vector<int> seen(producers * perProducer, 0);
+    std::thread consumer([&] {
+        int item;
+        while(queue.pop(item)) ++seen[item];
+    });
+
+    for(std::thread& thread : threads) thread.join();
+    queue.close();
+    consumer.join();
+
+    for(int count : seen) CHECK(count == 1);
+}
+
@@ -0,0 +1,59 @@
+#include "test.h"
+
+#include <thread>
+#include <atomic>
+
+TEST(SnapshotStableWhileAppending) {
+    Blockchain chain;
+    CHECK(BuildChain(chain, "snapshot", 100));
+
+    ChainSnapshot snapshot = chain.GetBlockChain();
+    CHECK(snapshot.size() == 101);
+
+    // a reader walks the snapshot over and over while the owner appends
+    std::atomic<bool> writing {true};
+    bool stable = true;
+    std::thread reader([&] {
+        do {
+            size_t count = 0;
+            for(const BlockView& block : snapshot){
+                stable = stable && block.id == count && (count == 0 || block.data == "block " + std::to_string(count));
+                ++count;
+            }
+            stable = stable && count == 101;
+        } while(writing);
+    });
+
+    std::vector<BlockRequest> requests;
+    for(uint32_t i=100; i < 5100; ++i) requests.push_back({ i, "", "block " + std::to_string(i + 1) });
+    CHECK(chain.CreateBlocks(requests, "", 2));
+    writing = false;
+    reader.join();
+
+    CHECK(stable);
+    CHECK(snapshot.size() == 101);
+    CHECK(chain.GetBlockChain().size() == 5101);
+}
+
+TEST(SnapshotBlocksReplacement) {
+    Blockchain chain;
+    CHECK(BuildChain(chain, "kept", 5));
+    auto blocks = BlockSet(chain);
+
+    {
+        ChainSnapshot snapshot = chain.GetBlockChain();
+        ChainSnapshot copy = snapshot;
+        ChainSnapshot assigned = chain.GetBlockChain();
+        assigned = copy;
+
+        // the old chain stays whole and usable while any snapshot of it lives
+        CHECK(!chain.GenerateNewBlockChain("replacement", 32, SignatureAlgorithm::EcdsaP256));
+        CHECK(BlockSet(chain) == blocks);
+        CHECK(chain.CreateBlock(5, "", "still the old chain"));
+        CHECK(snapshot.size() == 6 && copy.size() == 6 && assigned.size() == 6);
+    }
+
+    // the last snapshot is gone
+    CHECK(chain.GenerateNewBlockChain("replacement", 32, SignatureAlgorithm::EcdsaP256));
+    CHECK(chain.GetBlockChainSize() == 1);
+}
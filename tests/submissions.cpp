@@ -0,0 +1,151 @@
+#include "test.h"
+
+#include <thread>
+#include <filesystem>
+
+TEST(MpscQueueKeepsProducerOrder) {
+    MpscQueue<std::pair<int, int>> queue; // (producer, sequence)
+    const int producers = 4, perProducer = 2000;
+
+    std::vector<std::thread> threads;
+    for(int p=0; p < producers; ++p){
+        threads.emplace_back([&queue, p] {
+            for(int i=0; i < perProducer; ++i) queue.push({ p, i });
+        });
+    }
+
+    std::vector<int> next(producers, 0);
+    size_t received = 0;
+    bool ordered = true;
+    std::vector<std::pair<int, int>> batch;
+    while(received < size_t(producers * perProducer)){
+        queue.wait();
+        batch.clear();
+        CHECK(queue.drain(batch)); // not closed yet
+        for(const auto& item : batch){
+            if(item.second != next[item.first]) ordered = false;
+            next[item.first] = item.second + 1;
+        }
+        received += batch.size();
+    }
+
+    for(std::thread& thread : threads) thread.join();
+    CHECK(ordered);
+    CHECK(received == size_t(producers * perProducer));
+}
+
+TEST(MpscQueueStopsAtClose) {
+    MpscQueue<int> queue;
+    queue.push(1);
+    queue.push(2);
+    queue.close();
+    queue.push(3); // after the marker, destroyed rather than delivered
+
+    std::vector<int> items;
+    CHECK(!queue.drain(items));
+    CHECK(items == std::vector<int>({ 1, 2 }));
+
+    items.clear();
+    queue.push(4);
+    CHECK(queue.drain(items)); // a drain without the marker reports the queue open again
+    CHECK(items == std::vector<int>({ 4 }));
+}
+
+TEST(SubmissionsLifecycle) {
+    Blockchain chain;
+    CHECK(NewChain(chain, "submissions"));
+
+    CHECK(chain.SubmitBlock(0, "", "too early").get() == UINT32_MAX); // no sequencer yet
+
+    std::string path = TempPath("submissions.chain");
+    CHECK(chain.ExportBlockChain(path));
+    CHECK(chain.StartSubmissions(path, 4));
+
+    const int submitters = 4, perSubmitter = 25;
+    std::vector<std::future<uint32_t>> futures[submitters];
+    std::vector<std::thread> threads;
+    for(int s=0; s < submitters; ++s){
+        threads.emplace_back([&chain, &futures, s] {
+            for(int i=0; i < perSubmitter; ++i) futures[s].push_back(chain.SubmitBlock(0, "", "submitted " + std::to_string(s) + "/" + std::to_string(i)));
+        });
+    }
+    for(std::thread& thread : threads) thread.join();
+
+    std::set<uint32_t> ids;
+    for(auto& list : futures){
+        uint32_t previous = 0;
+        for(auto& future : list){
+            uint32_t id = future.get();
+            CHECK(id != UINT32_MAX);
+            CHECK(id > previous); // one submitter's blocks get ids in submission order
+            previous = id;
+            ids.insert(id);
+        }
+    }
+    CHECK(ids.size() == size_t(submitters * perSubmitter));
+
+    chain.StopSubmissions();
+    CHECK(chain.SubmitBlock(0, "", "too late").get() == UINT32_MAX);
+
+    // every answered block was appended to the file
+    Blockchain reloaded;
+    CHECK(reloaded.ImportBlockChain(path));
+    CHECK(reloaded.GetBlockChainSize() == size_t(submitters * perSubmitter + 1));
+    BlockView block;
+    for(uint32_t id : ids) CHECK(reloaded.GetBlock(id, block));
+}
+
+TEST(SubmissionsUnwritablePath) {
+    Blockchain chain;
+    CHECK(BuildChain(chain, "unwritable", 2));
+    auto stored = BlockSet(chain);
+
+    std::string missing = TempPath("missing") + "/directory/chain";
+    CHECK(chain.StartSubmissions(missing, 1));
+    CHECK(chain.SubmitBlock(2, "", "nowhere to go").get() == UINT32_MAX);
+    chain.StopSubmissions();
+
+    // a block answered as failed is not in the chain either
+    CHECK(BlockSet(chain) == stored);
+    BlockView block;
+    CHECK(!chain.GetBlock(3, block));
+}
+
+TEST(SubmissionsFailedAppendNotStored) {
+    Blockchain chain;
+    CHECK(BuildChain(chain, "failed", 2));
+
+    std::string path = TempPath("failed.chain");
+    CHECK(chain.ExportBlockChain(path));
+    CHECK(chain.StartSubmissions(path, 2));
+
+    uint32_t first = chain.SubmitBlock(2, "", "first").get();
+    CHECK(first == 3);
+
+    // the file can't be opened while this batch is appended
+    std::string saved = ReadFileBytes(path);
+    std::filesystem::remove(path);
+    std::filesystem::create_directory(path);
+    CHECK(chain.SubmitBlock(first, "", "lost").get() == UINT32_MAX);
+
+    BlockView block;
+    CHECK(chain.GetBlockChainSize() == 4);
+    CHECK(!chain.GetBlock(4, block));
+
+    // once the file is back the failed block doesn't come out with the next batch
+    std::filesystem::remove(path);
+    CHECK(WriteFileBytes(path, saved));
+    uint32_t second = chain.SubmitBlock(first, "", "second").get();
+    CHECK(second == 4);
+    chain.StopSubmissions();
+
+    CHECK(chain.GetBlock(second, block) && block.data == "second");
+
+    Blockchain reloaded;
+    CHECK(reloaded.ImportBlockChain(path));
+    CHECK(reloaded.GetBlockChainSize() == 5);
+    CHECK(BlockSet(reloaded) == BlockSet(chain));
+    bool lost = false;
+    for(const BlockView& view : reloaded.GetBlockChain()) lost = lost || view.data == "lost";
+    CHECK(!lost);
+}
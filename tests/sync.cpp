@@ -0,0 +1,108 @@
+#include "test.h"
+
+#include <thread>
+
+class CountingTransport : public Transport { // counts the bytes received over another transport
+    Transport& inner;
+
+public:
+    size_t received;
+
+    CountingTransport(Transport& inner): inner(inner), received(0) {}
+
+    bool Send(const char* data, size_t size) override { return inner.Send(data, size); }
+    bool Receive(char* data, size_t size) override {
+        if(!inner.Receive(data, size)) return false;
+        received += size;
+        return true;
+    }
+    void Close() override { inner.Close(); }
+};
+
+static bool Sync(Blockchain& server, Blockchain& client, size_t& received) {
+    std::string address = TempPath("sync.sock");
+    SocketListener listener(address);
+    if(!listener.IsOpen()) return false;
+
+    bool served = false;
+    std::thread serving([&] {
+        std::unique_ptr<SocketTransport> peer = listener.Accept();
+        served = peer && server.ServeSync(*peer);
+    });
+
+    std::unique_ptr<SocketTransport> peer = SocketTransport::Connect(listener.Address());
+    bool synced = false;
+    if(peer){
+        CountingTransport counted(*peer);
+        synced = client.SyncFrom(counted, 4);
+        received = counted.received;
+        peer->Close();
+    } else {
+        listener.Close();
+    }
+
+    serving.join();
+    return synced && served;
+}
+
+TEST(SyncConverges) {
+    Blockchain server;
+    CHECK(NewChain(server, "sync"));
+
+    std::vector<BlockRequest> requests;
+    for(uint32_t i=0; i < 200; ++i) requests.push_back({ i % 9 == 4 ? i / 3 : i, "", "trunk " + std::to_string(i) });
+    CHECK(server.CreateBlocks(requests, "", 4));
+
+    Blockchain client;
+    size_t first = 0;
+    CHECK(Sync(server, client, first));
+    CHECK(BlockSet(client) == BlockSet(server));
+
+    BlockView serverTip, clientTip;
+    CHECK(server.GetCanonicalTip(serverTip) && client.GetCanonicalTip(clientTip) && serverTip.id == clientTip.id);
+    CHECK(server.GetLeaves().size() == client.GetLeaves().size());
+
+    // new side branches off old blocks and a longer trunk come over on the next sync
+    std::vector<BlockRequest> more;
+    for(uint32_t i=0; i < 20; ++i) more.push_back({ i * 9 + 1, "", "branch " + std::to_string(i) });
+    more.push_back({ serverTip.id, "", "trunk end" });
+    CHECK(server.CreateBlocks(more, "", 2));
+
+    size_t second = 0;
+    CHECK(Sync(server, client, second));
+    CHECK(BlockSet(client) == BlockSet(server));
+    CHECK(second < first);
+
+    // nothing left to send
+    size_t third = 0;
+    CHECK(Sync(server, client, third));
+    CHECK(BlockSet(client) == BlockSet(server));
+    CHECK(third < second);
+    CHECK(third * 10 < first);
+}
+
+TEST(SyncKeepsLocalBlocks) {
+    Blockchain server;
+    CHECK(NewChain(server, "diverged"));
+    CHECK(server.CreateBlocks({ { 0, "", "a" }, { 1, "", "b" }, { 2, "", "c" } }));
+
+    Blockchain client;
+    size_t received = 0;
+    CHECK(Sync(server, client, received));
+    CHECK(ShareKeys(server, client));
+
+    // both sides grow their own branch; the client gets the server's and keeps its own
+    CHECK(server.CreateBlock(3, "", "server side"));
+    CHECK(client.CreateBlock(2, "", "client side"));
+    auto local = BlockSet(client);
+
+    CHECK(Sync(server, client, received));
+    auto merged = BlockSet(client);
+    for(const auto& entry : local) CHECK(merged.count(entry));
+
+    auto remote = BlockSet(server);
+    for(const auto& entry : remote){
+        if(entry.first != 4) CHECK(merged.count(entry)); // both sides created an id 4
+    }
+    CHECK(merged.size() == local.size() + remote.size() - 4 - 1); // the shared blocks, and the server's 4 conflicts
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "blockchain.h"
+#include "metrics.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <set>
+
+// TEST(name) registers a case with the runner in tests/main.cpp, CHECK records a failure and carries on
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+std::vector<TestCase>& TestCases();
+void TestFailure(const char* file, int line, const char* expression);
+
+#define TEST(name) \
+    static void name(); \
+    static const bool name##Registered = (TestCases().push_back({ #name, name }), true); \
+    static void name()
+
+#define CHECK(expression) do { if(!(expression)) TestFailure(__FILE__, __LINE__, #expression); } while(0)
+
+// shared fixtures
+std::string TempPath(const std::string& name); // unique to this run, removed when the runner exits
+std::string ReadFileBytes(const std::string& path);
+bool WriteFileBytes(const std::string& path, const std::string& bytes);
+
+bool NewChain(Blockchain& chain, const std::string& name); // ECDSA keys, fast to sign with
+bool BuildChain(Blockchain& chain, const std::string& name, uint32_t blocks); // root and a straight line of blocks 1..blocks
+bool BuildForkedChain(Blockchain& chain, const std::string& name); // 60 blocks on a trunk with side branches
+bool ShareKeys(Blockchain& from, Blockchain& to); // the current user of from becomes the current user of to
+std::set<std::pair<uint32_t, std::string>> BlockSet(Blockchain& chain); // (id, hash) of every stored block
+uint64_t CounterValue(Counter counter);
+uint64_t FailureValue(Failure reason);
+
+// flips a byte of block id's signature (or data) in a chain file; fixCrc keeps the record checksum valid
+bool TamperRecord(const std::string& path, uint32_t id, bool signature, bool fixCrc);
@@ -0,0 +1,53 @@
+#include "test.h"
+
+TEST(ParallelMatchesSequential) {
+    Blockchain source;
+    CHECK(BuildForkedChain(source, "parallel"));
+
+    std::string path = TempPath("parallel.chain");
+    CHECK(source.ExportBlockChain(path));
+
+    // bad signatures behind valid checksums, so they reach the validators
+    const uint32_t tampered[] = { 5, 23, 41, 58 };
+    for(uint32_t id : tampered) CHECK(TamperRecord(path, id, true, true));
+
+    Blockchain sequential, parallel, wide;
+    CHECK(sequential.ImportBlockChain(path, 1));
+    CHECK(parallel.ImportBlockChain(path, 4));
+    CHECK(wide.ImportBlockChain(path, 16));
+
+    auto accepted = BlockSet(sequential);
+    CHECK(!accepted.empty());
+    CHECK(accepted.size() < source.GetBlockChainSize());
+    CHECK(BlockSet(parallel) == accepted);
+    CHECK(BlockSet(wide) == accepted);
+
+    BlockView block;
+    for(uint32_t id : tampered){
+        CHECK(!sequential.GetBlock(id, block));
+        CHECK(!parallel.GetBlock(id, block));
+        CHECK(!wide.GetBlock(id, block));
+    }
+
+    // every accepted block is one the source signed
+    auto signedBlocks = BlockSet(source);
+    for(const auto& entry : accepted) CHECK(signedBlocks.count(entry));
+}
+
+TEST(ParallelKeepsFileOrder) {
+    Blockchain source;
+    CHECK(BuildForkedChain(source, "order"));
+
+    std::string path = TempPath("order.chain");
+    CHECK(source.ExportBlockChain(path));
+
+    Blockchain parallel;
+    CHECK(parallel.ImportBlockChain(path, 8));
+    CHECK(parallel.GetBlockChainSize() == source.GetBlockChainSize());
+
+    // blocks are stored in file order whatever thread validated them
+    ChainSnapshot expected = source.GetBlockChain(), stored = parallel.GetBlockChain();
+    bool ordered = (expected.size() == stored.size());
+    for(size_t i=0; ordered && i < stored.size(); ++i) ordered = (stored[i].id == expected[i].id);
+    CHECK(ordered);
+}